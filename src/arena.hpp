@@ -0,0 +1,129 @@
+#ifndef RKMH_ARENA_HPP
+#define RKMH_ARENA_HPP
+
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+using namespace std;
+
+/**
+ * A bump allocator over a list of slabs. alloc() hands out the next
+ * n items of the current slab, moving on to the next slab (or making
+ * a new one, at least as large as the request) when it runs out;
+ * nothing is freed individually. reset() and rewind() make the space
+ * reusable without giving the slabs back, so a loop over batches stops
+ * allocating once the arena has grown to the largest batch it has seen.
+ * The exception is slabs made larger than slab_bytes for one big request
+ * (a whole chromosome, say): those are freed as soon as they are unused.
+ */
+class Arena{
+    public:
+        /** A point to rewind() back to. */
+        struct mark_t{
+            size_t slab;
+            size_t pos;
+        };
+
+        Arena(size_t slab_bytes = 1 << 20){
+            this->slab_bytes = slab_bytes;
+        };
+
+        /** Space for n T's, aligned for T, valid until the arena is reset or rewound past it. */
+        template<typename T>
+        inline T* alloc(size_t n){
+            size_t bytes = n * sizeof(T);
+            while (true){
+                if (cur < slabs.size()){
+                    size_t start = (pos + alignof(T) - 1) & ~(alignof(T) - 1);
+                    if (start + bytes <= slabs[cur].size){
+                        pos = start + bytes;
+                        return (T*) (slabs[cur].data.get() + start);
+                    }
+                    if (cur + 1 == slabs.size()){
+                        slabs.emplace_back(std::max(slab_bytes, bytes + alignof(T)));
+                    }
+                    ++cur;
+                    pos = 0;
+                }
+                else{
+                    slabs.emplace_back(std::max(slab_bytes, bytes + alignof(T)));
+                    cur = slabs.size() - 1;
+                    pos = 0;
+                }
+            }
+        };
+
+        inline mark_t mark() const{
+            return {cur, pos};
+        };
+
+        /** Free everything allocated since m was taken. */
+        inline void rewind(const mark_t& m){
+            cur = m.slab;
+            pos = m.pos;
+            drop_oversized(cur + 1);
+        };
+
+        /** Free everything. */
+        inline void reset(){
+            cur = 0;
+            pos = 0;
+            drop_oversized(0);
+        };
+
+        /** Bytes held in slabs, used or not. */
+        inline size_t capacity() const{
+            size_t c = 0;
+            for (auto& s : slabs){
+                c += s.size;
+            }
+            return c;
+        };
+
+    private:
+        struct slab_t{
+            unique_ptr<char[]> data;
+            size_t size;
+            slab_t(size_t size) : data(new char[size]), size(size){};
+        };
+        vector<slab_t> slabs;
+        size_t cur = 0;
+        size_t pos = 0;
+        size_t slab_bytes;
+
+        inline void drop_oversized(size_t from){
+            if (from >= slabs.size()){
+                return;
+            }
+            size_t limit = slab_bytes;
+            slabs.erase(std::remove_if(slabs.begin() + from, slabs.end(),
+                        [limit](const slab_t& s){ return s.size > limit; }),
+                    slabs.end());
+        };
+};
+
+/**
+ * The calling thread's scratch arena, for memory that only lives
+ * as long as the record being worked on (see arena_scope_t).
+ */
+inline Arena& thread_arena(){
+    static thread_local Arena arena;
+    return arena;
+}
+
+/** Rewinds an arena, on destruction, to where it was on construction. */
+struct arena_scope_t{
+    Arena& arena;
+    Arena::mark_t m;
+
+    arena_scope_t(Arena& arena) : arena(arena), m(arena.mark()){};
+
+    ~arena_scope_t(){
+        arena.rewind(m);
+    };
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef RKMH_BBIT_SKETCH_HPP
+#define RKMH_BBIT_SKETCH_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include "mkmh.hpp"
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * b-bit one-permutation sketches (see SKETCH_ONE_PERM in bottom_sketch.hpp).
+ * Only the low b bits (1, 2 or 4) of each slot's hash are kept, packed 64 / b
+ * slots to a word, along with one bit per slot saying whether it is filled.
+ * That is 1 + b bits a slot rather than 64, so a whole reference panel stays
+ * in cache while every read is compared with it.
+ *
+ * Two sketches are compared a word at a time with XOR and popcount, without
+ * branches. Slots filled in both whose b bits agree are counted, and the
+ * count is corrected for the 2^-b chance that unrelated hashes agree anyway.
+ */
+inline bool valid_bbit_bits(int bits){
+    return bits == 1 || bits == 2 || bits == 4;
+}
+
+/** Words of packed slot bits, then of filled bits, in a sketch of slots slots. */
+inline int bbit_value_words(int slots, int bits){
+    return (slots * bits + 63) / 64;
+}
+
+inline int bbit_filled_words(int slots){
+    return (slots + 63) / 64;
+}
+
+/**
+ * Pack a one-permutation sketch (slots hashes, 0 for an empty slot) into out,
+ * which must hold bbit_value_words + bbit_filled_words words.
+ */
+inline void bbit_pack(const hash_t* sketch, int slots, int bits, uint64_t* out){
+    int vw = bbit_value_words(slots, bits);
+    uint64_t* filled = out + vw;
+    memset(out, 0, (vw + bbit_filled_words(slots)) * sizeof(uint64_t));
+    uint64_t mask = (1ULL << bits) - 1;
+    for (int i = 0; i < slots; ++i){
+        if (sketch[i] != 0){
+            out[(i * bits) / 64] |= (sketch[i] & mask) << ((i * bits) % 64);
+            filled[i / 64] |= 1ULL << (i % 64);
+        }
+    }
+}
+
+// Spread the low 64 / bits bits of x out to the low bit of each bits-wide field.
+inline uint64_t bbit_spread(uint64_t x, int bits){
+    if (bits == 2){
+        x &= 0xffffffffULL;
+        x = (x | (x << 16)) & 0x0000ffff0000ffffULL;
+        x = (x | (x << 8)) & 0x00ff00ff00ff00ffULL;
+        x = (x | (x << 4)) & 0x0f0f0f0f0f0f0f0fULL;
+        x = (x | (x << 2)) & 0x3333333333333333ULL;
+        x = (x | (x << 1)) & 0x5555555555555555ULL;
+    }
+    else if (bits == 4){
+        x &= 0xffffULL;
+        x = (x | (x << 24)) & 0x000000ff000000ffULL;
+        x = (x | (x << 12)) & 0x000f000f000f000fULL;
+        x = (x | (x << 6)) & 0x0303030303030303ULL;
+        x = (x | (x << 3)) & 0x1111111111111111ULL;
+    }
+    return x;
+}
+
+// Set the low bit of each bits-wide field of z that has any bit set, and clear the rest.
+inline uint64_t bbit_fold(uint64_t z, int bits){
+    if (bits == 2){
+        return (z | (z >> 1)) & 0x5555555555555555ULL;
+    }
+    if (bits == 4){
+        z |= z >> 1;
+        z |= z >> 2;
+        return z & 0x1111111111111111ULL;
+    }
+    return z;
+}
+
+/** Slots filled in both a and b, in either, and filled in both with the same b bits. */
+struct bbit_counts_t{
+    int both = 0;
+    int any = 0;
+    int agree = 0;
+};
+
+template<int BITS>
+inline bbit_counts_t bbit_compare_bits(const uint64_t* a, const uint64_t* b, int slots){
+    const int per_word = 64 / BITS;
+    int vw = bbit_value_words(slots, BITS);
+    const uint64_t* af = a + vw;
+    const uint64_t* bf = b + vw;
+    bbit_counts_t c;
+    for (int w = 0; w < bbit_filled_words(slots); ++w){
+        c.both += __builtin_popcountll(af[w] & bf[w]);
+        c.any += __builtin_popcountll(af[w] | bf[w]);
+    }
+    for (int w = 0; w < vw; ++w){
+        int first = w * per_word;
+        uint64_t fa = af[first / 64] >> (first % 64);
+        uint64_t fb = bf[first / 64] >> (first % 64);
+        uint64_t both = bbit_spread(fa & fb, BITS);
+        uint64_t differ = bbit_fold(a[w] ^ b[w], BITS);
+        c.agree += __builtin_popcountll(both & ~differ);
+    }
+    return c;
+}
+
+inline bbit_counts_t bbit_compare_generic(const uint64_t* a, const uint64_t* b, int slots, int bits){
+    switch (bits){
+        case 1: return bbit_compare_bits<1>(a, b, slots);
+        case 2: return bbit_compare_bits<2>(a, b, slots);
+        default: return bbit_compare_bits<4>(a, b, slots);
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// the same loop, with popcount as one instruction rather than a bit-twiddling routine
+__attribute__((target("popcnt")))
+inline bbit_counts_t bbit_compare_popcnt(const uint64_t* a, const uint64_t* b, int slots, int bits){
+    return bbit_compare_generic(a, b, slots, bits);
+}
+#endif
+
+/** Compare two packed sketches, with the popcnt instruction if this CPU has it. */
+inline bbit_counts_t bbit_compare(const uint64_t* a, const uint64_t* b, int slots, int bits){
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool popcnt = __builtin_cpu_supports("popcnt");
+    if (popcnt){
+        return bbit_compare_popcnt(a, b, slots, bits);
+    }
+#endif
+    return bbit_compare_generic(a, b, slots, bits);
+}
+
+/**
+ * Estimated slots whose full hashes agree: of the slots filled in both,
+ * the fraction agreeing in b bits is J + (1 - J) / 2^b, solved for J.
+ * Comparable with the shared count of bottom sketches of the same size.
+ */
+inline int bbit_estimate_shared(const bbit_counts_t& c, int bits){
+    if (c.both == 0){
+        return 0;
+    }
+    double chance = 1.0 / (1 << bits);
+    double j = ((double) c.agree / c.both - chance) / (1.0 - chance);
+    return j <= 0.0 ? 0 : (int) (j * c.both + 0.5);
+}
+
+/**
+ * A panel of packed b-bit sketches, one row of words after another
+ * in a single array, so comparing a read with all of them streams
+ * through memory once.
+ */
+class BbitPanel{
+    public:
+        BbitPanel(int slots, int bits){
+            this->slots = slots;
+            this->bits = bits;
+            row = bbit_value_words(slots, bits) + bbit_filled_words(slots);
+        };
+
+        /** Words a packed sketch (e.g. a read's, see pack()) takes. */
+        inline int row_words() const{
+            return row;
+        };
+
+        inline uint64_t size() const{
+            return words.size() / row;
+        };
+
+        /** Append a one-permutation sketch of slots hashes. */
+        inline void add(const hash_t* sketch){
+            words.resize(words.size() + row);
+            pack(sketch, words.data() + words.size() - row);
+        };
+
+        /** Pack a sketch into out (row_words() words) for comparing with the panel. */
+        inline void pack(const hash_t* sketch, uint64_t* out) const{
+            bbit_pack(sketch, slots, bits, out);
+        };
+
+        /** Estimated slots sketch i shares with a packed sketch (see bbit_estimate_shared). */
+        inline int shared(uint64_t i, const uint64_t* packed) const{
+            return bbit_estimate_shared(bbit_compare(words.data() + i * row, packed, slots, bits), bits);
+        };
+
+        inline uint64_t bytes() const{
+            return words.size() * sizeof(uint64_t);
+        };
+
+    private:
+        int slots;
+        int bits;
+        int row;
+        vector<uint64_t> words;
+};
+
+#endif
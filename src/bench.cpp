@@ -0,0 +1,1369 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <zlib.h>
+#include <omp.h>
+#include <getopt.h>
+#include "mkmh.hpp"
+#include "kseq_reader.hpp"
+#include "pipeline.hpp"
+#include "radix_sort.hpp"
+#include "ref_index.hpp"
+#include "intersect.hpp"
+#include "top_two.hpp"
+#include "cache_info.hpp"
+
+using namespace std;
+using namespace mkmh;
+using namespace KSR;
+
+/**
+ * Microbenchmarks for rkmh's I/O and hashing paths.
+ *
+ * ./rkmh_bench gzip -f data/z1_long.fq -t 4 -n 20
+ *  builds gzip and BGZF copies of the input (repeated n times) and reports
+ *  reads/s for plain kseq reading versus the InflateStream reader,
+ *  with and without hashing.
+ *
+ * ./rkmh_bench files -f data/z1_long.fq -t 4 -n 100
+ *  splits the input into n gzipped files and reports reads/s for reading
+ *  them one after another (BatchReader) versus concurrently
+ *  (MultiFileBatchReader), with and without hashing.
+ *
+ * ./rkmh_bench simd -n 10000000 -k 16
+ *  reports hashes/s for the rolling hash's mixing kernel and for the whole
+ *  rolling hash over a random sequence of n bases, for each instruction set
+ *  this CPU supports, and checks that they all give the same hashes.
+ *
+ * ./rkmh_bench fixedk -n 10000000
+ *  reports hashes/s over a random sequence of n bases for the generic
+ *  hashing kernel versus the one compiled for each kmer size (-k, by
+ *  default every size that has one), for both hash functions.
+ *
+ * ./rkmh_bench multik -n 10000000 -k 12 -k 16 -k 21
+ *  reports hashes/s over a random sequence of n bases for hashing each
+ *  kmer size in its own pass versus all of them in one pass.
+ *
+ * ./rkmh_bench radix -f data/all_pave_ref.fa -t 4
+ *  reports hashes/s for std::sort versus the radix sorts (with scratch and
+ *  in place) on the input's hashes: one array per record, all of them as
+ *  one array, and cut into read-sized arrays.
+ *
+ * ./rkmh_bench index -r data/all_pave_ref.fa -f data/z1_long.fq -c 10
+ *  sketches each reference record (c copies of the panel, each with its
+ *  hashes scrambled) and each read, and reports reads/s for intersecting
+ *  every read with every reference versus counting through a RefIndex,
+ *  along with the index's build time, size and save / load round trip.
+ *
+ * ./rkmh_bench intersect -s 1000 -m 1024
+ *  reports hashes/s for intersecting a sorted array of s random hashes with
+ *  one 1, 2, 4 ... m times longer (sharing half of the shorter one's hashes),
+ *  for the scalar merge, the block merge, galloping and the dispatching
+ *  hash_intersection_count, and checks that they all agree.
+ *
+ * ./rkmh_bench tiles -r 4096 -s 1000 -n 4096 -t 4
+ *  builds a random panel of r one-permutation sketches of s slots and n
+ *  reads (each agreeing with one reference on half its slots), and reports
+ *  reads/s for scoring each read against the whole panel in turn versus
+ *  tiles of reads against cache-sized tiles of references, and checks
+ *  that both find every read's reference.
+ */
+
+void print_help(char** argv){
+    cerr << "Usage: " << argv[0] << " { gzip | files | simd | fixedk | multik | radix | index | intersect | tiles } [options]" << endl
+        << "    gzip: reads/s for single-threaded vs. background / block-parallel decompression." << endl
+        << "    files: reads/s for many small files read serially vs. by a pool of reader threads." << endl
+        << "    simd: hashes/s for the scalar vs. AVX2 / AVX-512 rolling hash kernels." << endl
+        << "    fixedk: hashes/s for the generic vs. fixed-k hashing kernels." << endl
+        << "    multik: hashes/s for one pass per kmer size vs. one pass for all of them." << endl
+        << "    radix: hashes/s for std::sort vs. the (parallel) radix sorts." << endl
+        << "    index: reads/s for per-reference intersections vs. an inverted reference index." << endl
+        << "    intersect: hashes/s for merging vs. block-merging vs. galloping sorted hash arrays." << endl
+        << "    tiles: reads/s for one read at a time vs. cache-sized tiles of reads and references." << endl
+        << endl;
+}
+
+void help_gzip(char** argv){
+    cerr << "Usage: " << argv[0] << " gzip [options]" << endl
+        << "Options:" << endl
+        << "--fasta/-f <FASTQ>       uncompressed FASTA/FASTQ to compress and read back." << endl
+        << "--threads/-t <THREADS>   number of OpenMP threads to utilize." << endl
+        << "--repeat/-n <N>          concatenate the input N times (default 20)." << endl
+        << "--kmer/-k <KMER>         kmer size for the hashing runs (default 16)." << endl
+        << "--tmp/-T <PREFIX>        prefix for the compressed copies (default /tmp/rkmh_bench)." << endl
+        << endl;
+}
+
+void help_files(char** argv){
+    cerr << "Usage: " << argv[0] << " files [options]" << endl
+        << "Options:" << endl
+        << "--fasta/-f <FASTQ>       uncompressed FASTQ to split into files." << endl
+        << "--threads/-t <THREADS>   number of OpenMP threads to utilize." << endl
+        << "--files/-n <N>           number of files to split the input into (default 100)." << endl
+        << "--kmer/-k <KMER>         kmer size for the hashing runs (default 16)." << endl
+        << "--tmp/-T <PREFIX>        prefix for the split files (default /tmp/rkmh_bench)." << endl
+        << endl;
+}
+
+/**
+ * Write data as a BGZF file: independent deflate blocks of
+ * at most 64KB with the BC extra field, then the EOF block.
+ */
+bool write_bgzf(const string& filename, const vector<char>& data){
+    FILE* fp = fopen(filename.c_str(), "wb");
+    if (fp == NULL){
+        return false;
+    }
+    const int max_block = 0xff00;
+    vector<unsigned char> cdata(compressBound(max_block) + 64);
+    for (size_t off = 0; off < data.size(); off += max_block){
+        int len = std::min((size_t) max_block, data.size() - off);
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+        zs.next_in = (Bytef*) data.data() + off;
+        zs.avail_in = len;
+        zs.next_out = cdata.data();
+        zs.avail_out = cdata.size();
+        deflate(&zs, Z_FINISH);
+        int clen = zs.total_out;
+        deflateEnd(&zs);
+
+        int bsize = 18 + clen + 8 - 1;
+        unsigned char h[18] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 'B', 'C', 2, 0,
+            (unsigned char) (bsize & 0xff), (unsigned char) (bsize >> 8)};
+        uint32_t crc = crc32(0L, (const Bytef*) data.data() + off, len);
+        uint32_t isize = len;
+        unsigned char t[8];
+        for (int i = 0; i < 4; ++i){
+            t[i] = (crc >> (8 * i)) & 0xff;
+            t[4 + i] = (isize >> (8 * i)) & 0xff;
+        }
+        fwrite(h, 1, 18, fp);
+        fwrite(cdata.data(), 1, clen, fp);
+        fwrite(t, 1, 8, fp);
+    }
+    static const unsigned char eof_block[28] = {31, 139, 8, 4, 0, 0, 0, 0, 0, 255, 6, 0, 66, 67, 2, 0,
+        27, 0, 3, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    fwrite(eof_block, 1, 28, fp);
+    fclose(fp);
+    return true;
+}
+
+void help_simd(char** argv){
+    cerr << "Usage: " << argv[0] << " simd [options]" << endl
+        << "Options:" << endl
+        << "--bases/-n <N>           length of the random test sequence (default 10000000)." << endl
+        << "--kmer/-k <KMER>         kmer size to hash (default 16, at most 32)." << endl
+        << "--repeat/-r <R>          time the best of R runs of each kernel (default 5)." << endl
+        << endl;
+}
+
+void help_fixedk(char** argv){
+    cerr << "Usage: " << argv[0] << " fixedk [options]" << endl
+        << "Options:" << endl
+        << "--bases/-n <N>           length of the random test sequence (default 10000000)." << endl
+        << "--kmer/-k <KMER>         kmer size to compare (default: each one with its own kernel)." << endl
+        << "--repeat/-r <R>          time the best of R runs of each kernel (default 3)." << endl
+        << endl;
+}
+
+void help_multik(char** argv){
+    cerr << "Usage: " << argv[0] << " multik [options]" << endl
+        << "Options:" << endl
+        << "--bases/-n <N>           length of the random test sequence (default 10000000)." << endl
+        << "--kmer/-k <KMER>         kmer size to hash; pass several (default 12, 16 and 21)." << endl
+        << "--repeat/-r <R>          time the best of R runs of each kernel (default 3)." << endl
+        << endl;
+}
+
+void help_radix(char** argv){
+    cerr << "Usage: " << argv[0] << " radix [options]" << endl
+        << "Options:" << endl
+        << "--fasta/-f <FASTA>       sequences to hash and sort (default data/all_pave_ref.fa)." << endl
+        << "--kmer/-k <KMER>         kmer size (default 16)." << endl
+        << "--threads/-t <THREADS>   number of OpenMP threads (default 1)." << endl
+        << "--read-len/-l <L>        hashes per array when cut into reads (default 150)." << endl
+        << "--repeat/-r <R>          time the best of R runs of each sort (default 3)." << endl
+        << endl;
+}
+
+void help_index(char** argv){
+    cerr << "Usage: " << argv[0] << " index [options]" << endl
+        << "Options:" << endl
+        << "--reference/-r <FASTA>   references to sketch (default data/all_pave_ref.fa)." << endl
+        << "--fasta/-f <FASTQ>       reads to sketch and classify (default data/z1_long.fq)." << endl
+        << "--kmer/-k <KMER>         kmer size (default 16)." << endl
+        << "--sketch-size/-s <S>     sketch size (default 1000)." << endl
+        << "--copies/-c <C>          copies of the reference panel, each with its own hashes (default 10)." << endl
+        << "--threads/-t <THREADS>   number of OpenMP threads (default 1)." << endl
+        << endl;
+}
+
+void help_intersect(char** argv){
+    cerr << "Usage: " << argv[0] << " intersect [options]" << endl
+        << "Options:" << endl
+        << "--size/-s <S>            hashes in the shorter array (default 1000)." << endl
+        << "--max-ratio/-m <M>       longest array, as a multiple of the shorter (default 1024)." << endl
+        << "--work/-n <N>            hashes to intersect per method and ratio (default 50000000)." << endl
+        << endl;
+}
+
+void help_tiles(char** argv){
+    cerr << "Usage: " << argv[0] << " tiles [options]" << endl
+        << "Options:" << endl
+        << "--refs/-r <R>            reference sketches in the panel (default 4096)." << endl
+        << "--slots/-s <S>           slots per sketch (default 1000)." << endl
+        << "--reads/-n <N>           reads to classify (default 4096)." << endl
+        << "--threads/-t <THREADS>   number of OpenMP threads (default 1)." << endl
+        << endl;
+}
+
+// Baseline: the gzopen / kseq_read loop used by parse_fastas.
+uint64_t kseq_count(char* f, vector<int>& kmer, bool hash){
+    gzFile fp = gzopen(f, "r");
+    kseq_t* seq = kseq_init(fp);
+    uint64_t n = 0;
+    while (kseq_read(seq) >= 0){
+        if (hash){
+            hash_t* h;
+            int num;
+            calc_hashes(seq->seq.s, seq->seq.l, kmer, h, num);
+            delete [] h;
+        }
+        ++n;
+    }
+    kseq_destroy(seq);
+    gzclose(fp);
+    return n;
+}
+
+template<typename READER>
+uint64_t reader_count(READER& reader, vector<int>& kmer, bool hash){
+    if (!hash){
+        seq_batch_t b;
+        uint64_t n = 0;
+        while (reader.next_batch(b) > 0){
+            n += b.size();
+        }
+        return n;
+    }
+    return pipelined_for_each(reader,
+            [&](seq_batch_t& b){},
+            [&](seq_batch_t& b, int i){
+                hash_t* h;
+                int num;
+                b.hash(i, kmer, h, num, thread_arena());
+            });
+}
+
+uint64_t pipeline_count(char* f, vector<int>& kmer, bool hash){
+    vector<char*> files = {f};
+    BatchReader reader(files, 1 << 26);
+    return reader_count(reader, kmer, hash);
+}
+
+int main_gzip(int argc, char** argv){
+    char* input = NULL;
+    int threads = 1;
+    int repeat = 20;
+    vector<int> kmer;
+    string prefix = "/tmp/rkmh_bench";
+
+    int c;
+    optind = 2;
+
+    if (argc <= 2){
+        help_gzip(argv);
+        exit(1);
+    }
+
+    while (true){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"fasta", required_argument, 0, 'f'},
+            {"threads", required_argument, 0, 't'},
+            {"repeat", required_argument, 0, 'n'},
+            {"kmer", required_argument, 0, 'k'},
+            {"tmp", required_argument, 0, 'T'},
+            {0,0,0,0}
+        };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hf:t:n:k:T:", long_options, &option_index);
+        if (c == -1){
+            break;
+        }
+
+        switch (c){
+            case 'f':
+                input = optarg;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'n':
+                repeat = atoi(optarg);
+                break;
+            case 'k':
+                kmer.push_back(atoi(optarg));
+                break;
+            case 'T':
+                prefix = optarg;
+                break;
+            case '?':
+            case 'h':
+            default:
+                help_gzip(argv);
+                exit(1);
+        }
+    }
+
+    if (input == NULL){
+        help_gzip(argv);
+        exit(1);
+    }
+    if (kmer.empty()){
+        kmer.push_back(16);
+    }
+    omp_set_num_threads(threads);
+
+    ifstream ifi(input, ios::binary);
+    vector<char> raw((istreambuf_iterator<char>(ifi)), istreambuf_iterator<char>());
+    vector<char> data;
+    data.reserve(raw.size() * repeat);
+    for (int i = 0; i < repeat; ++i){
+        data.insert(data.end(), raw.begin(), raw.end());
+    }
+
+    string plain_file = prefix + ".fq";
+    string gz_file = prefix + ".fq.gz";
+    string bgzf_file = prefix + ".fq.bgz";
+
+    ofstream ofi(plain_file, ios::binary);
+    ofi.write(data.data(), data.size());
+    ofi.close();
+
+    gzFile gz = gzopen(gz_file.c_str(), "wb");
+    gzwrite(gz, data.data(), data.size());
+    gzclose(gz);
+
+    write_bgzf(bgzf_file, data);
+
+    cout << "input\treader\thash\treads\tseconds\treads/s" << endl;
+    vector<string> inputs = {plain_file, gz_file, bgzf_file};
+    for (auto f : inputs){
+        for (int hash = 0; hash < 2; ++hash){
+            double start = omp_get_wtime();
+            uint64_t n = kseq_count((char*) f.c_str(), kmer, hash);
+            double t = omp_get_wtime() - start;
+            cout << f << "\t" << "kseq" << "\t" << hash << "\t" << n << "\t" << t << "\t" << (uint64_t) (n / t) << endl;
+
+            start = omp_get_wtime();
+            n = pipeline_count((char*) f.c_str(), kmer, hash);
+            t = omp_get_wtime() - start;
+            cout << f << "\t" << "pipeline" << "\t" << hash << "\t" << n << "\t" << t << "\t" << (uint64_t) (n / t) << endl;
+        }
+    }
+
+    remove(plain_file.c_str());
+    remove(gz_file.c_str());
+    remove(bgzf_file.c_str());
+
+    return 0;
+}
+
+int main_files(int argc, char** argv){
+    char* input = NULL;
+    int threads = 1;
+    int num_files = 100;
+    vector<int> kmer;
+    string prefix = "/tmp/rkmh_bench";
+
+    int c;
+    optind = 2;
+
+    if (argc <= 2){
+        help_files(argv);
+        exit(1);
+    }
+
+    while (true){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"fasta", required_argument, 0, 'f'},
+            {"threads", required_argument, 0, 't'},
+            {"files", required_argument, 0, 'n'},
+            {"kmer", required_argument, 0, 'k'},
+            {"tmp", required_argument, 0, 'T'},
+            {0,0,0,0}
+        };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hf:t:n:k:T:", long_options, &option_index);
+        if (c == -1){
+            break;
+        }
+
+        switch (c){
+            case 'f':
+                input = optarg;
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'n':
+                num_files = atoi(optarg);
+                break;
+            case 'k':
+                kmer.push_back(atoi(optarg));
+                break;
+            case 'T':
+                prefix = optarg;
+                break;
+            case '?':
+            case 'h':
+            default:
+                help_files(argv);
+                exit(1);
+        }
+    }
+
+    if (input == NULL || num_files < 1){
+        help_files(argv);
+        exit(1);
+    }
+    if (kmer.empty()){
+        kmer.push_back(16);
+    }
+    omp_set_num_threads(threads);
+
+    // split on FASTQ record boundaries (four lines each)
+    ifstream ifi(input);
+    vector<string> lines;
+    string line;
+    while (getline(ifi, line)){
+        lines.push_back(line);
+    }
+    int records = lines.size() / 4;
+    int per_file = (records + num_files - 1) / num_files;
+
+    vector<string> names;
+    for (int f = 0; f < num_files && f * per_file < records; ++f){
+        string name = prefix + "." + to_string(f) + ".fq.gz";
+        gzFile gz = gzopen(name.c_str(), "wb");
+        for (int r = f * per_file; r < std::min(records, (f + 1) * per_file); ++r){
+            for (int l = 0; l < 4; ++l){
+                gzwrite(gz, lines[4 * r + l].data(), lines[4 * r + l].size());
+                gzwrite(gz, "\n", 1);
+            }
+        }
+        gzclose(gz);
+        names.push_back(name);
+    }
+    vector<char*> files;
+    for (auto& n : names){
+        files.push_back((char*) n.c_str());
+    }
+
+    cout << "files\treader\thash\treads\tseconds\treads/s" << endl;
+    for (int hash = 0; hash < 2; ++hash){
+        double start = omp_get_wtime();
+        BatchReader serial(files, 1 << 26);
+        uint64_t n = reader_count(serial, kmer, hash);
+        double t = omp_get_wtime() - start;
+        cout << files.size() << "\t" << "serial" << "\t" << hash << "\t" << n << "\t" << t << "\t" << (uint64_t) (n / t) << endl;
+
+        start = omp_get_wtime();
+        MultiFileBatchReader pool(files, 1 << 26);
+        n = reader_count(pool, kmer, hash);
+        t = omp_get_wtime() - start;
+        cout << files.size() << "\t" << "pool" << "\t" << hash << "\t" << n << "\t" << t << "\t" << (uint64_t) (n / t) << endl;
+    }
+
+    for (auto& n : names){
+        remove(n.c_str());
+    }
+
+    return 0;
+}
+
+// Best of repeat runs of f, in seconds.
+template<typename F>
+double best_time(int repeat, F f){
+    double best = 0.0;
+    for (int r = 0; r < repeat; ++r){
+        double start = omp_get_wtime();
+        f();
+        double t = omp_get_wtime() - start;
+        if (r == 0 || t < best){
+            best = t;
+        }
+    }
+    return best;
+}
+
+// The benchmarks' random numbers (splitmix64), seeded so runs are comparable.
+struct bench_rng_t{
+    uint64_t state;
+
+    bench_rng_t(uint64_t seed = 42) : state(seed){};
+
+    inline uint64_t next(){
+        state += 0x9e3779b97f4a7c15ULL;
+        uint64_t z = state;
+        z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+        return z ^ (z >> 31);
+    };
+};
+
+// n random bases
+string bench_bases(int n, bench_rng_t& rng){
+    string seq(n, 'A');
+    for (int i = 0; i < n; ++i){
+        seq[i] = "ACGT"[rng.next() & 3];
+    }
+    return seq;
+}
+
+int main_simd(int argc, char** argv){
+    int bases = 10000000;
+    int k = 16;
+    int repeat = 5;
+
+    int c;
+    optind = 2;
+
+    while (true){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"bases", required_argument, 0, 'n'},
+            {"kmer", required_argument, 0, 'k'},
+            {"repeat", required_argument, 0, 'r'},
+            {0,0,0,0}
+        };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hn:k:r:", long_options, &option_index);
+        if (c == -1){
+            break;
+        }
+
+        switch (c){
+            case 'n':
+                bases = atoi(optarg);
+                break;
+            case 'k':
+                k = atoi(optarg);
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            case '?':
+            case 'h':
+            default:
+                help_simd(argv);
+                exit(1);
+        }
+    }
+
+    if (k < 1 || k > 32 || bases < k || repeat < 1){
+        help_simd(argv);
+        exit(1);
+    }
+
+    bench_rng_t rng;
+    string seq = bench_bases(bases, rng);
+    uint64_t mask = k == 32 ? ~0ULL : (1ULL << (2 * k)) - 1;
+    vector<uint64_t> fwd(bases);
+    vector<uint64_t> rev(bases);
+    for (int i = 0; i < bases; ++i){
+        fwd[i] = rng.next() & mask;
+        rev[i] = rng.next() & mask;
+    }
+
+    seq_view_t v;
+    v.seq = seq.c_str();
+    v.seq_span = bases;
+    v.seq_len = bases;
+    int num = num_kmer_hashes(bases, k);
+
+    vector<hash_t> mix_ref(bases);
+    vector<hash_t> roll_ref(num);
+    mix_kmer_words(fwd.data(), rev.data(), bases, k, false, mix_ref.data(), HASH_ISA_SCALAR);
+    rolling_hashes_into(v, k, roll_ref.data(), CANONICAL_MIN_HASH, HASH_ISA_SCALAR);
+
+    cout << "isa\tkernel\thashes\tseconds\thashes/s\tmatches" << endl;
+    vector<hash_isa_t> isas = {HASH_ISA_SCALAR, HASH_ISA_AVX2, HASH_ISA_AVX512};
+    for (auto isa : isas){
+        if (!hash_isa_supported(isa)){
+            cout << hash_isa_name(isa) << "\tunsupported" << endl;
+            continue;
+        }
+        vector<hash_t> out(bases);
+        double t = best_time(repeat, [&](){
+                mix_kmer_words(fwd.data(), rev.data(), bases, k, false, out.data(), isa);
+                });
+        bool same = out == mix_ref;
+        cout << hash_isa_name(isa) << "\t" << "mix" << "\t" << bases << "\t" << t << "\t"
+            << (uint64_t) (bases / t) << "\t" << (same ? "yes" : "no") << endl;
+
+        out.resize(num);
+        t = best_time(repeat, [&](){
+                rolling_hashes_into(v, k, out.data(), CANONICAL_MIN_HASH, isa);
+                });
+        same = out == roll_ref;
+        cout << hash_isa_name(isa) << "\t" << "rolling" << "\t" << num << "\t" << t << "\t"
+            << (uint64_t) (num / t) << "\t" << (same ? "yes" : "no") << endl;
+    }
+
+    return 0;
+}
+
+int main_fixedk(int argc, char** argv){
+    int bases = 10000000;
+    vector<int> kmer;
+    int repeat = 3;
+
+    int c;
+    optind = 2;
+
+    while (true){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"bases", required_argument, 0, 'n'},
+            {"kmer", required_argument, 0, 'k'},
+            {"repeat", required_argument, 0, 'r'},
+            {0,0,0,0}
+        };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hn:k:r:", long_options, &option_index);
+        if (c == -1){
+            break;
+        }
+
+        switch (c){
+            case 'n':
+                bases = atoi(optarg);
+                break;
+            case 'k':
+                kmer.push_back(atoi(optarg));
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            case '?':
+            case 'h':
+            default:
+                help_fixedk(argv);
+                exit(1);
+        }
+    }
+
+    if (kmer.empty()){
+        kmer = {12, 15, 16, 18, 20, 21, 31};
+    }
+    if (bases < 1 || repeat < 1){
+        help_fixedk(argv);
+        exit(1);
+    }
+
+    bench_rng_t rng;
+    string seq = bench_bases(bases, rng);
+    seq_view_t v = buffer_view(seq.c_str(), bases);
+
+    cout << "hash\tk\tkernel\thashes\tseconds\thashes/s\tmatches" << endl;
+    vector<hash_fn_t> fns = {HASH_MURMUR3, HASH_ROLLING};
+    for (auto fn : fns){
+        hash_scheme_t scheme;
+        scheme.fn = fn;
+        for (auto k : kmer){
+            if (fn == HASH_ROLLING && k > 32){
+                continue;
+            }
+            int num = num_kmer_hashes(bases, k);
+            vector<hash_t> generic(num);
+            vector<hash_t> fixed(num);
+            auto into = [](hash_t*& out){
+                return [&out](const hash_t* h, int n){
+                    memcpy(out, h, n * sizeof(hash_t));
+                    out += n;
+                };
+            };
+            double t = best_time(repeat, [&](){
+                    hash_t* out = generic.data();
+                    for_each_hash_k<0>(v, k, scheme, into(out));
+                    });
+            cout << hash_fn_name(fn) << "\t" << k << "\t" << "generic" << "\t" << num << "\t" << t << "\t"
+                << (uint64_t) (num / t) << "\t" << "yes" << endl;
+            t = best_time(repeat, [&](){
+                    hash_t* out = fixed.data();
+                    for_each_hash(v, k, scheme, into(out));
+                    });
+            cout << hash_fn_name(fn) << "\t" << k << "\t" << "dispatch" << "\t" << num << "\t" << t << "\t"
+                << (uint64_t) (num / t) << "\t" << (fixed == generic ? "yes" : "no") << endl;
+        }
+    }
+
+    return 0;
+}
+
+int main_multik(int argc, char** argv){
+    int bases = 10000000;
+    vector<int> kmer;
+    int repeat = 3;
+
+    int c;
+    optind = 2;
+
+    while (true){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"bases", required_argument, 0, 'n'},
+            {"kmer", required_argument, 0, 'k'},
+            {"repeat", required_argument, 0, 'r'},
+            {0,0,0,0}
+        };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hn:k:r:", long_options, &option_index);
+        if (c == -1){
+            break;
+        }
+
+        switch (c){
+            case 'n':
+                bases = atoi(optarg);
+                break;
+            case 'k':
+                kmer.push_back(atoi(optarg));
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            case '?':
+            case 'h':
+            default:
+                help_multik(argv);
+                exit(1);
+        }
+    }
+
+    if (kmer.empty()){
+        kmer = {12, 16, 21};
+    }
+    if (bases < 1 || repeat < 1){
+        help_multik(argv);
+        exit(1);
+    }
+
+    bench_rng_t rng;
+    string seq = bench_bases(bases, rng);
+    seq_view_t v = buffer_view(seq.c_str(), bases);
+    int num = num_kmer_hashes(bases, kmer);
+
+    cout << "hash\tsizes\tkernel\thashes\tseconds\thashes/s\tmatches" << endl;
+    vector<hash_fn_t> fns = {HASH_MURMUR3, HASH_ROLLING};
+    for (auto fn : fns){
+        hash_scheme_t scheme;
+        scheme.fn = fn;
+        bool too_long = false;
+        for (auto k : kmer){
+            too_long |= fn == HASH_ROLLING && k > 32;
+        }
+        if (too_long){
+            continue;
+        }
+        vector<hash_t> per_size(num);
+        vector<hash_t> one_pass(num);
+        double t = best_time(repeat, [&](){
+                hash_t* out = per_size.data();
+                for (auto k : kmer){
+                    calc_hashes_into(v, k, out, scheme);
+                    out += num_kmer_hashes(bases, k);
+                }
+                });
+        cout << hash_fn_name(fn) << "\t" << kmer.size() << "\t" << "per-size" << "\t" << num << "\t" << t << "\t"
+            << (uint64_t) (num / t) << "\t" << "yes" << endl;
+        t = best_time(repeat, [&](){
+                calc_hashes_into(v, kmer, one_pass.data(), scheme);
+                });
+        cout << hash_fn_name(fn) << "\t" << kmer.size() << "\t" << "one-pass" << "\t" << num << "\t" << t << "\t"
+            << (uint64_t) (num / t) << "\t" << (one_pass == per_size ? "yes" : "no") << endl;
+    }
+
+    return 0;
+}
+
+// Best of repeat runs of sort(arrays, lens, num) on fresh copies of input, in seconds.
+// matches is cleared if any run doesn't give sorted.
+template<typename F>
+double best_sort_time(int repeat, const vector<vector<hash_t> >& input,
+        const vector<vector<hash_t> >& sorted, bool& matches, F sort){
+    double best = 0.0;
+    matches = true;
+    for (int r = 0; r < repeat; ++r){
+        vector<vector<hash_t> > arrays(input);
+        vector<hash_t*> ptrs;
+        vector<int> lens;
+        for (auto& a : arrays){
+            ptrs.push_back(a.data());
+            lens.push_back(a.size());
+        }
+        double start = omp_get_wtime();
+        sort(ptrs.data(), lens.data(), (int) arrays.size());
+        double t = omp_get_wtime() - start;
+        if (r == 0 || t < best){
+            best = t;
+        }
+        matches &= arrays == sorted;
+    }
+    return best;
+}
+
+int main_radix(int argc, char** argv){
+    char* input = (char*) "data/all_pave_ref.fa";
+    int k = 16;
+    int threads = 1;
+    int read_len = 150;
+    int repeat = 3;
+
+    int c;
+    optind = 2;
+
+    while (true){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"fasta", required_argument, 0, 'f'},
+            {"kmer", required_argument, 0, 'k'},
+            {"threads", required_argument, 0, 't'},
+            {"read-len", required_argument, 0, 'l'},
+            {"repeat", required_argument, 0, 'r'},
+            {0,0,0,0}
+        };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hf:k:t:l:r:", long_options, &option_index);
+        if (c == -1){
+            break;
+        }
+
+        switch (c){
+            case 'f':
+                input = optarg;
+                break;
+            case 'k':
+                k = atoi(optarg);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case 'l':
+                read_len = atoi(optarg);
+                break;
+            case 'r':
+                repeat = atoi(optarg);
+                break;
+            case '?':
+            case 'h':
+            default:
+                help_radix(argv);
+                exit(1);
+        }
+    }
+
+    if (k < 1 || read_len < 1 || repeat < 1){
+        help_radix(argv);
+        exit(1);
+    }
+    omp_set_num_threads(threads);
+
+    vector<int> kmer = {k};
+    vector<vector<hash_t> > records;
+    vector<char*> files = {input};
+    BatchReader reader(files, 1 << 26);
+    seq_batch_t batch;
+    while (reader.next_batch(batch) > 0){
+        for (int i = 0; i < batch.size(); ++i){
+            vector<hash_t> h(batch.num_hashes(i, kmer));
+            batch.hash_into(i, kmer, h.data());
+            records.push_back(h);
+        }
+    }
+    vector<vector<hash_t> > whole(1);
+    vector<vector<hash_t> > reads;
+    for (auto& r : records){
+        whole[0].insert(whole[0].end(), r.begin(), r.end());
+    }
+    for (size_t i = 0; i < whole[0].size(); i += read_len){
+        size_t end = std::min(whole[0].size(), i + read_len);
+        reads.push_back(vector<hash_t>(whole[0].begin() + i, whole[0].begin() + end));
+    }
+
+    cout << "arrays	sort	count	hashes	seconds	hashes/s	matches" << endl;
+    vector<pair<string, vector<vector<hash_t> >* > > cases = {
+        {"records", &records}, {"whole", &whole}, {"reads", &reads}};
+    for (auto& cs : cases){
+        vector<vector<hash_t> >& input = *cs.second;
+        uint64_t num = 0;
+        vector<vector<hash_t> > sorted(input);
+        for (auto& a : sorted){
+            std::sort(a.begin(), a.end());
+            num += a.size();
+        }
+        auto report = [&](const string& name, double t, bool matches){
+            cout << cs.first << "\t" << name << "\t" << input.size() << "\t" << num << "\t" << t << "\t"
+                << (uint64_t) (num / t) << "\t" << (matches ? "yes" : "no") << endl;
+        };
+        bool matches;
+        double t = best_sort_time(repeat, input, sorted, matches, [&](hash_t** h, int* lens, int n){
+                #pragma omp parallel for schedule(dynamic, 1)
+                for (int i = 0; i < n; ++i){
+                    std::sort(h[i], h[i] + lens[i]);
+                }
+                });
+        report("std::sort", t, matches);
+        t = best_sort_time(repeat, input, sorted, matches, [&](hash_t** h, int* lens, int n){
+                radix_sort_each(h, lens, n);
+                });
+        report("radix", t, matches);
+        t = best_sort_time(repeat, input, sorted, matches, [&](hash_t** h, int* lens, int n){
+                radix_sort_each(h, lens, n, true);
+                });
+        report("radix-in-place", t, matches);
+    }
+
+    return 0;
+}
+
+// The bottom sketch_size hashes of each record of f, sorted ascending.
+vector<vector<hash_t> > bench_sketches(char* f, vector<int>& kmer, int sketch_size){
+    vector<vector<hash_t> > ret;
+    vector<char*> files = {f};
+    BatchReader reader(files, 1 << 26);
+    seq_batch_t batch;
+    while (reader.next_batch(batch) > 0){
+        for (int i = 0; i < batch.size(); ++i){
+            vector<hash_t> h(batch.num_hashes(i, kmer));
+            batch.hash_into(i, kmer, h.data());
+            radix_sort(h.data(), h.size());
+            hash_t* mins;
+            int min_num;
+            sorted_minhashes(h.data(), h.size(), sketch_size, mins, min_num);
+            ret.push_back(vector<hash_t>(mins, mins + min_num));
+            delete [] mins;
+        }
+    }
+    return ret;
+}
+
+int main_index(int argc, char** argv){
+    char* ref_file = (char*) "data/all_pave_ref.fa";
+    char* read_file = (char*) "data/z1_long.fq";
+    int k = 16;
+    int sketch_size = 1000;
+    int copies = 10;
+    int threads = 1;
+
+    int c;
+    optind = 2;
+
+    while (true){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"reference", required_argument, 0, 'r'},
+            {"fasta", required_argument, 0, 'f'},
+            {"kmer", required_argument, 0, 'k'},
+            {"sketch-size", required_argument, 0, 's'},
+            {"copies", required_argument, 0, 'c'},
+            {"threads", required_argument, 0, 't'},
+            {0,0,0,0}
+        };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hr:f:k:s:c:t:", long_options, &option_index);
+        if (c == -1){
+            break;
+        }
+
+        switch (c){
+            case 'r':
+                ref_file = optarg;
+                break;
+            case 'f':
+                read_file = optarg;
+                break;
+            case 'k':
+                k = atoi(optarg);
+                break;
+            case 's':
+                sketch_size = atoi(optarg);
+                break;
+            case 'c':
+                copies = atoi(optarg);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case '?':
+            case 'h':
+            default:
+                help_index(argv);
+                exit(1);
+        }
+    }
+
+    if (k < 1 || sketch_size < 1 || copies < 1){
+        help_index(argv);
+        exit(1);
+    }
+    omp_set_num_threads(threads);
+
+    vector<int> kmer = {k};
+    vector<vector<hash_t> > panel = bench_sketches(ref_file, kmer, sketch_size);
+    vector<vector<hash_t> > reads = bench_sketches(read_file, kmer, sketch_size);
+
+    // every copy after the first gets its hashes scrambled, so copies share nothing
+    vector<vector<hash_t> > refs;
+    for (int cp = 0; cp < copies; ++cp){
+        for (auto& r : panel){
+            vector<hash_t> x(r);
+            for (auto& h : x){
+                h = cp == 0 ? h : (h ^ (0x9e3779b97f4a7c15ULL * cp)) | 1;
+            }
+            std::sort(x.begin(), x.end());
+            refs.push_back(x);
+        }
+    }
+    int nrefs = refs.size();
+    vector<hash_t*> ref_ptrs;
+    vector<int> ref_lens;
+    for (auto& r : refs){
+        ref_ptrs.push_back(r.data());
+        ref_lens.push_back(r.size());
+    }
+
+    double start = omp_get_wtime();
+    RefIndex index(ref_ptrs.data(), ref_lens.data(), nrefs);
+    double build = omp_get_wtime() - start;
+
+    string fn = "rkmh_bench_index.tmp";
+    start = omp_get_wtime();
+    RefIndex loaded;
+    bool round_trip = index.save(fn, kmer, HASH_MURMUR3, sketch_size) &&
+        loaded.load(fn, ref_ptrs.data(), ref_lens.data(), nrefs, kmer, HASH_MURMUR3, sketch_size);
+    double save_load = omp_get_wtime() - start;
+    remove(fn.c_str());
+
+    // a checksum of every read's best match, to check the two ways agree
+    uint64_t scan_sum = 0;
+
+    start = omp_get_wtime();
+    #pragma omp parallel for schedule(dynamic, 64) reduction(+:scan_sum)
+    for (int i = 0; i < reads.size(); ++i){
+        int best = -1;
+        int best_id = 0;
+        for (int j = 0; j < nrefs; ++j){
+            int shared = 0;
+            hash_intersection_size(reads[i].data(), reads[i].size(), ref_ptrs[j], ref_lens[j], shared);
+            if (shared > best){
+                best = shared;
+                best_id = j;
+            }
+        }
+        scan_sum += (uint64_t) best * nrefs + best_id;
+    }
+    double scan = omp_get_wtime() - start;
+
+    // the index as built, then as loaded
+    double times[2];
+    uint64_t sums[2];
+    RefIndex* indexes[2] = {&index, &loaded};
+    for (int pass = 0; pass < 2; ++pass){
+        const RefIndex& ix = *indexes[pass];
+        uint64_t sum = 0;
+        start = omp_get_wtime();
+        #pragma omp parallel reduction(+:sum)
+        {
+            vector<int> shared(nrefs);
+            #pragma omp for schedule(dynamic, 64)
+            for (int i = 0; i < reads.size(); ++i){
+                ix.count(reads[i].data(), reads[i].size(), shared.data());
+                int best = -1;
+                int best_id = 0;
+                for (int j = 0; j < nrefs; ++j){
+                    if (shared[j] > best){
+                        best = shared[j];
+                        best_id = j;
+                    }
+                }
+                sum += (uint64_t) best * nrefs + best_id;
+            }
+        }
+        times[pass] = omp_get_wtime() - start;
+        sums[pass] = sum;
+    }
+
+    cerr << "Indexed " << nrefs << " reference sketches (" << index.size() << " distinct hashes, "
+        << index.bytes() / 1024 << " KB) in " << build << "s; save and load took " << save_load << "s"
+        << (round_trip && sums[1] == sums[0] ? "" : " and FAILED") << "." << endl;
+    cout << "method	refs	reads	seconds	reads/s	matches" << endl;
+    cout << "intersect\t" << nrefs << "\t" << reads.size() << "\t" << scan << "\t"
+        << (uint64_t) (reads.size() / scan) << "\tyes" << endl;
+    cout << "index\t" << nrefs << "\t" << reads.size() << "\t" << times[0] << "\t"
+        << (uint64_t) (reads.size() / times[0]) << "\t" << (sums[0] == scan_sum ? "yes" : "no") << endl;
+
+    return 0;
+}
+
+int main_intersect(int argc, char** argv){
+    int size = 1000;
+    int max_ratio = 1024;
+    uint64_t work = 50000000;
+
+    int c;
+    optind = 2;
+
+    while (true){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"size", required_argument, 0, 's'},
+            {"max-ratio", required_argument, 0, 'm'},
+            {"work", required_argument, 0, 'n'},
+            {0,0,0,0}
+        };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hs:m:n:", long_options, &option_index);
+        if (c == -1){
+            break;
+        }
+
+        switch (c){
+            case 's':
+                size = atoi(optarg);
+                break;
+            case 'm':
+                max_ratio = atoi(optarg);
+                break;
+            case 'n':
+                work = strtoull(optarg, NULL, 10);
+                break;
+            case '?':
+            case 'h':
+            default:
+                help_intersect(argv);
+                exit(1);
+        }
+    }
+
+    if (size < 1 || max_ratio < 1){
+        help_intersect(argv);
+        exit(1);
+    }
+
+    bench_rng_t rng;
+
+    cout << "ratio	method	short	long	pairs	seconds	hashes/s	matches" << endl;
+    for (int ratio = 1; ratio <= max_ratio; ratio *= 2){
+        vector<hash_t> longer((uint64_t) size * ratio);
+        for (auto& x : longer){
+            x = rng.next();
+        }
+        std::sort(longer.begin(), longer.end());
+        // many short arrays, taking turns, so neither the compiler nor the
+        // branch predictor can learn one; none repeats a hash
+        const int num_short = 1024;
+        vector<vector<hash_t> > shorter(num_short, vector<hash_t>(size));
+        vector<int> expected(num_short);
+        for (int s = 0; s < num_short; ++s){
+            for (int i = 0; i < size; ++i){
+                shorter[s][i] = i % 2 == 0 ? longer[(uint64_t) i * ratio + rng.next() % ratio] : rng.next();
+            }
+            std::sort(shorter[s].begin(), shorter[s].end());
+            hash_intersection_size(shorter[s].data(), size, longer.data(), longer.size(), expected[s]);
+        }
+
+        uint64_t per_pair = size + longer.size();
+        uint64_t pairs = std::max((uint64_t) 1, work / per_pair);
+
+        vector<pair<string, std::function<uint64_t(const hash_t*)> > > methods = {
+            {"merge", [&](const hash_t* a){
+                int n;
+                hash_intersection_size(a, size, longer.data(), longer.size(), n);
+                return (uint64_t) n;
+            }},
+            {"block", [&](const hash_t* a){ return block_intersection_count(a, size, longer.data(), longer.size()); }},
+            {"gallop", [&](const hash_t* a){ return gallop_intersection_count(a, size, longer.data(), longer.size(), false); }},
+            {"dispatch", [&](const hash_t* a){ return hash_intersection_count(a, size, longer.data(), longer.size()); }}
+        };
+        for (auto& m : methods){
+            bool matches = true;
+            double start = omp_get_wtime();
+            for (uint64_t p = 0; p < pairs; ++p){
+                matches &= m.second(shorter[p % num_short].data()) == expected[p % num_short];
+            }
+            double t = omp_get_wtime() - start;
+            cout << ratio << "\t" << m.first << "\t" << size << "\t" << longer.size() << "\t" << pairs << "\t"
+                << t << "\t" << (uint64_t) (pairs * per_pair / t) << "\t" << (matches ? "yes" : "no") << endl;
+        }
+    }
+
+    return 0;
+}
+
+int main_tiles(int argc, char** argv){
+    int refs = 4096;
+    int slots = 1000;
+    int reads = 4096;
+    int threads = 1;
+
+    int c;
+    optind = 2;
+
+    while (true){
+        static struct option long_options[] =
+        {
+            {"help", no_argument, 0, 'h'},
+            {"refs", required_argument, 0, 'r'},
+            {"slots", required_argument, 0, 's'},
+            {"reads", required_argument, 0, 'n'},
+            {"threads", required_argument, 0, 't'},
+            {0,0,0,0}
+        };
+
+        int option_index = 0;
+        c = getopt_long(argc, argv, "hr:s:n:t:", long_options, &option_index);
+        if (c == -1){
+            break;
+        }
+
+        switch (c){
+            case 'r':
+                refs = atoi(optarg);
+                break;
+            case 's':
+                slots = atoi(optarg);
+                break;
+            case 'n':
+                reads = atoi(optarg);
+                break;
+            case 't':
+                threads = atoi(optarg);
+                break;
+            case '?':
+            case 'h':
+            default:
+                help_tiles(argv);
+                exit(1);
+        }
+    }
+
+    if (refs < 1 || slots < 1 || reads < 1){
+        help_tiles(argv);
+        exit(1);
+    }
+    omp_set_num_threads(threads);
+
+    bench_rng_t rng;
+
+    vector<hash_t> panel((uint64_t) refs * slots);
+    for (auto& x : panel){
+        x = rng.next() | 1;
+    }
+    vector<hash_t> queries((uint64_t) reads * slots);
+    vector<int> source(reads);
+    for (int r = 0; r < reads; ++r){
+        source[r] = rng.next() % refs;
+        for (int i = 0; i < slots; ++i){
+            queries[(uint64_t) r * slots + i] = rng.next() % 2 ? panel[(uint64_t) source[r] * slots + i] : rng.next() | 1;
+        }
+    }
+
+    uint64_t row_bytes = slots * sizeof(hash_t);
+    int ref_tile = tile_rows(row_bytes, 0.5);
+    int read_tile = std::min(tile_rows(row_bytes, 0.25), 256);
+    cerr << "Level 2 cache of " << l2_cache_bytes() / 1024 << " KB: tiles of " << read_tile << " reads and "
+        << ref_tile << " references; the panel takes " << (panel.size() * sizeof(hash_t)) / 1024 << " KB." << endl;
+
+    cout << "method	reads	refs	read_tile	ref_tile	seconds	reads/s	matches" << endl;
+    for (int tiled = 0; tiled < 2; ++tiled){
+        int rt = tiled ? read_tile : 1;
+        int ft = tiled ? ref_tile : refs;
+        vector<int> best(reads);
+        double start = omp_get_wtime();
+        #pragma omp parallel for schedule(dynamic, 1)
+        for (int t = 0; t < reads; t += rt){
+            int n = std::min(reads - t, rt);
+            vector<top_two_t> tops(n, top_two_t(-1));
+            // every pair scored in full, as --bits sketches are
+            tiled_top_two(n, refs, ft, 0, tops.data(), [&](int r, int j, int need) -> int{
+                return one_perm_shared(panel.data() + (uint64_t) j * slots, queries.data() + (uint64_t) (t + r) * slots, slots);
+            });
+            for (int r = 0; r < n; ++r){
+                best[t + r] = tops[r].best_id;
+            }
+        }
+        double secs = omp_get_wtime() - start;
+        bool matches = best == source;
+        cout << (tiled ? "tiled" : "per-read") << "\t" << reads << "\t" << refs << "\t" << rt << "\t" << ft << "\t"
+            << secs << "\t" << (uint64_t) (reads / secs) << "\t" << (matches ? "yes" : "no") << endl;
+    }
+
+    return 0;
+}
+
+int main(int argc, char** argv){
+
+    if (argc <= 1){
+        print_help(argv);
+        exit(1);
+    }
+    string cmd = argv[1];
+    if (cmd == "gzip"){
+        return main_gzip(argc, argv);
+    }
+    else if (cmd == "files"){
+        return main_files(argc, argv);
+    }
+    else if (cmd == "simd"){
+        return main_simd(argc, argv);
+    }
+    else if (cmd == "fixedk"){
+        return main_fixedk(argc, argv);
+    }
+    else if (cmd == "multik"){
+        return main_multik(argc, argv);
+    }
+    else if (cmd == "radix"){
+        return main_radix(argc, argv);
+    }
+    else if (cmd == "index"){
+        return main_index(argc, argv);
+    }
+    else if (cmd == "intersect"){
+        return main_intersect(argc, argv);
+    }
+    else if (cmd == "tiles"){
+        return main_tiles(argc, argv);
+    }
+    else{
+        print_help(argv);
+        exit(1);
+    }
+
+}
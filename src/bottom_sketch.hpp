@@ -0,0 +1,304 @@
+#ifndef RKMH_BOTTOM_SKETCH_HPP
+#define RKMH_BOTTOM_SKETCH_HPP
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "mkmh.hpp"
+#include "arena.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace mkmh;
+
+/** How a sequence's hashes are reduced to a sketch (see BottomSketcher). */
+enum sketch_scheme_t{
+    SKETCH_BOTTOM,
+    SKETCH_ONE_PERM,
+    SKETCH_DENSE_ONE_PERM
+};
+
+/**
+ * Parse a --sketch-scheme argument: "bottom" (bottom-s) or "oph" (densified
+ * one-permutation). Returns false if name is neither.
+ */
+inline bool parse_sketch_scheme(const char* name, sketch_scheme_t& scheme){
+    string n(name);
+    if (n == "bottom"){
+        scheme = SKETCH_BOTTOM;
+        return true;
+    }
+    if (n == "oph"){
+        scheme = SKETCH_DENSE_ONE_PERM;
+        return true;
+    }
+    return false;
+}
+
+/** The slot of a one-permutation sketch of the given size that x falls in. */
+inline int one_perm_slot(hash_t x, int slots){
+    return ((x >> 32) * (uint64_t) slots) >> 32;
+}
+
+/** The attempt'th slot an empty slot probes when densified (the same in every sketch). */
+inline int densify_probe(int slot, int attempt, int slots){
+    uint64_t x = ((uint64_t) slot << 32) | (uint32_t) attempt;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return one_perm_slot(x ^ (x >> 31), slots);
+}
+
+inline int one_perm_shared_scalar(const hash_t* a, const hash_t* b, int len){
+    int shared = 0;
+    for (int i = 0; i < len; ++i){
+        shared += (a[i] == b[i] && a[i] != 0);
+    }
+    return shared;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/** one_perm_shared_scalar four slots at a time. */
+__attribute__((target("avx2")))
+inline int one_perm_shared_avx2(const hash_t* a, const hash_t* b, int len){
+    int shared = 0;
+    int i = 0;
+    __m256i zero = _mm256_setzero_si256();
+    for (; i + 4 <= len; i += 4){
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + i));
+        __m256i m = _mm256_andnot_si256(_mm256_cmpeq_epi64(va, zero), _mm256_cmpeq_epi64(va, vb));
+        shared += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+    }
+    return shared + one_perm_shared_scalar(a + i, b + i, len - i);
+}
+#endif
+
+/**
+ * How many slots two one-permutation sketches of len slots agree on,
+ * which for densified sketches estimates their Jaccard similarity times len.
+ */
+inline int one_perm_shared(const hash_t* a, const hash_t* b, int len){
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2){
+        return one_perm_shared_avx2(a, b, len);
+    }
+#endif
+    return one_perm_shared_scalar(a, b, len);
+}
+
+/**
+ * The bottom sketch_size nonzero hashes of a stream of hashes, kept in
+ * O(sketch_size) memory so a sequence never needs its full hash array.
+ * Hashes go into a buffer of 2 * sketch_size; when it fills, it is cut
+ * back to its smallest sketch_size (nth_element, no sort) and the largest
+ * of those becomes a threshold that later hashes must beat to get in.
+ * Past the first few thousand kmers almost every hash fails that one
+ * comparison. Duplicates are kept, so finish() gives exactly the sketch
+ * minhashes does for the same hashes.
+ *
+ * Given a max_hash (see scaled_max_hash), it makes a FracMinHash ("scaled")
+ * sketch instead: the set of distinct hashes below max_hash, however many
+ * there are, so its size follows the sequence's length. The buffer then
+ * grows (in the arena) rather than being cut back.
+ *
+ * With SKETCH_ONE_PERM, it makes a one-permutation sketch instead: the hash
+ * range is cut into sketch_size equal slots, each keeping the smallest hash
+ * that falls in it (0 if none). finish() gives the slots in order, not a
+ * sorted set; they are compared slot by slot (one_perm_shared, or packed
+ * in bbit_sketch.hpp). A short read leaves most slots empty, so with
+ * SKETCH_DENSE_ONE_PERM finish() also densifies them: each empty slot takes
+ * the hash of the first filled slot along its own probe sequence
+ * (densify_probe), which keeps agreeing slots an unbiased estimate of the
+ * Jaccard similarity. Either way no hash is sorted or selected; each is
+ * one comparison against its slot.
+ */
+class BottomSketcher{
+    public:
+        /** The buffer comes from arena and lives as long as its allocations do. */
+        BottomSketcher(int sketch_size, Arena& arena, hash_t max_hash = 0,
+                sketch_scheme_t scheme = SKETCH_BOTTOM) : arena(arena){
+            s = sketch_size;
+            one_perm = scheme != SKETCH_BOTTOM;
+            densify = scheme == SKETCH_DENSE_ONE_PERM;
+            if (one_perm){
+                buf = arena.alloc<hash_t>(std::max(s, 1));
+                std::fill(buf, buf + s, 0);
+                return;
+            }
+            scaled = max_hash != 0;
+            cap = scaled ? 64 : 2 * std::max(sketch_size, 1);
+            buf = arena.alloc<hash_t>(cap);
+            // an empty sketch wants nothing; a scaled one is cut off from the start
+            full = scaled || s <= 0;
+            threshold = scaled ? max_hash : 0;
+        };
+
+        /** True if x would (for now) make the sketch; callers can filter on anything else after this. */
+        inline bool wants(hash_t x) const{
+            if (one_perm){
+                hash_t y = buf[one_perm_slot(x, s)];
+                return x != 0 && (y == 0 || x < y);
+            }
+            return x != 0 && (!full || x < threshold);
+        };
+
+        /** Add x, which must be wanted. */
+        inline void push(hash_t x){
+            if (one_perm){
+                buf[one_perm_slot(x, s)] = x;
+                return;
+            }
+            buf[n++] = x;
+            if (n == cap){
+                if (scaled){
+                    grow();
+                }
+                else{
+                    shrink();
+                }
+            }
+        };
+
+        inline void add(hash_t x){
+            if (wants(x)){
+                push(x);
+            }
+        };
+
+        inline void add(const hash_t* h, int num){
+            for (int i = 0; i < num; ++i){
+                add(h[i]);
+            }
+        };
+
+        /**
+         * The sketch, sorted ascending. mins points into the sketcher's
+         * buffer; nothing more should be added after this.
+         */
+        inline void finish(hash_t*& mins, int& min_num){
+            if (one_perm){
+                num_filled = 0;
+                for (int i = 0; i < s; ++i){
+                    num_filled += buf[i] != 0;
+                }
+                if (densify){
+                    densify_slots();
+                }
+                mins = buf;
+                min_num = s;
+                return;
+            }
+            if (!scaled && n > s){
+                shrink();
+            }
+            std::sort(buf, buf + n);
+            if (scaled){
+                n = std::unique(buf, buf + n) - buf;
+            }
+            mins = buf;
+            min_num = n;
+            num_filled = n;
+        };
+
+        /**
+         * How many hashes went into the sketch from finish(). That is its
+         * length for a bottom sketch, but a one-permutation sketch always
+         * has sketch_size slots: this counts those a hash filled, before
+         * densifying, so a read with no kmers still has 0.
+         */
+        inline int filled() const{
+            return num_filled;
+        };
+
+    private:
+        Arena& arena;
+        hash_t* buf;
+        int s;
+        int cap;
+        int n = 0;
+        int num_filled = 0;
+        bool one_perm;
+        bool densify = false;
+        bool scaled = false;
+        bool full = true;
+        hash_t threshold = 0;
+
+        inline void shrink(){
+            std::nth_element(buf, buf + s - 1, buf + n);
+            n = s;
+            threshold = buf[s - 1];
+            full = true;
+        };
+
+        // probes must only land on slots filled by hashes, not by earlier densification
+        inline void densify_slots(){
+            if (num_filled == 0 || num_filled == s){
+                return;
+            }
+            hash_t* orig = arena.alloc<hash_t>(s);
+            memcpy(orig, buf, s * sizeof(hash_t));
+            for (int i = 0; i < s; ++i){
+                for (int attempt = 0; buf[i] == 0; ++attempt){
+                    buf[i] = orig[densify_probe(i, attempt, s)];
+                }
+            }
+        };
+
+        // drop repeats first, and only move to a bigger buffer if that didn't free half
+        inline void grow(){
+            std::sort(buf, buf + n);
+            n = std::unique(buf, buf + n) - buf;
+            if (2 * n > cap){
+                hash_t* bigger = arena.alloc<hash_t>(2 * cap);
+                memcpy(bigger, buf, n * sizeof(hash_t));
+                buf = bigger;
+                cap *= 2;
+            }
+        };
+};
+
+/**
+ * minhashes of hashes that are already sorted ascending: the first
+ * sketch_size nonzero ones, copied into a new array of sketch_size.
+ */
+inline void sorted_minhashes(const hash_t* hashes, int num_hashes, int sketch_size, hash_t*& mins, int& min_num){
+    const hash_t* start = std::upper_bound(hashes, hashes + num_hashes, (hash_t) 0);
+    min_num = std::min((int) (hashes + num_hashes - start), sketch_size);
+    mins = new hash_t[sketch_size];
+    memcpy(mins, start, min_num * sizeof(hash_t));
+}
+
+/**
+ * The largest hash (exclusive) a FracMinHash sketch with the given scale keeps:
+ * about one kmer in scale makes it. 0 (no scaled sketch) if scale is 0.
+ */
+inline hash_t scaled_max_hash(uint64_t scale){
+    return scale == 0 ? 0 : ~((hash_t) 0) / scale;
+}
+
+/**
+ * Parse a -x argument: a whole number, at least 1, that fits in 64 bits.
+ * Returns false for anything else (including signs, which strtoull would wrap).
+ */
+inline bool parse_scale(const char* arg, uint64_t& scale){
+    if (!isdigit((unsigned char) arg[0])){
+        return false;
+    }
+    char* end;
+    errno = 0;
+    unsigned long long x = strtoull(arg, &end, 10);
+    if (*end != '\0' || errno == ERANGE || x == 0){
+        return false;
+    }
+    scale = x;
+    return true;
+}
+
+#endif
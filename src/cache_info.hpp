@@ -0,0 +1,58 @@
+#ifndef RKMH_CACHE_INFO_HPP
+#define RKMH_CACHE_INFO_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <unistd.h>
+
+/**
+ * Sizes of this CPU's caches, for cutting work into tiles that stay
+ * resident while they are reused. glibc's sysconf is asked first, then
+ * Linux's sysfs; if neither knows, a cache of RKMH_DEFAULT_L2_BYTES is
+ * assumed, small enough that tiles built from it fit nearly anywhere.
+ */
+#define RKMH_DEFAULT_L2_BYTES (256 << 10)
+
+// sysfs gives sizes like "1024K"
+inline uint64_t sysfs_cache_bytes(int index){
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu0/cache/index%d/size", index);
+    FILE* fp = fopen(path, "r");
+    if (fp == NULL){
+        return 0;
+    }
+    unsigned long long n = 0;
+    char unit = 0;
+    int got = fscanf(fp, "%llu%c", &n, &unit);
+    fclose(fp);
+    if (got < 1){
+        return 0;
+    }
+    return n << (unit == 'K' ? 10 : unit == 'M' ? 20 : 0);
+}
+
+/** Bytes of (per-core) level 2 cache. */
+inline uint64_t l2_cache_bytes(){
+    static const uint64_t bytes = [](){
+        long n = 0;
+#ifdef _SC_LEVEL2_CACHE_SIZE
+        n = sysconf(_SC_LEVEL2_CACHE_SIZE);
+#endif
+        if (n > 0){
+            return (uint64_t) n;
+        }
+        // index0 and index1 are the level 1 data and instruction caches
+        uint64_t s = sysfs_cache_bytes(2);
+        return s > 0 ? s : (uint64_t) RKMH_DEFAULT_L2_BYTES;
+    }();
+    return bytes;
+}
+
+/** How many rows of row_bytes each fit in share of the level 2 cache (at least 1). */
+inline int tile_rows(uint64_t row_bytes, double share){
+    uint64_t n = (uint64_t) (l2_cache_bytes() * share) / std::max(row_bytes, (uint64_t) 1);
+    return (int) std::max((uint64_t) 1, std::min(n, (uint64_t) 1 << 20));
+}
+
+#endif
@@ -0,0 +1,294 @@
+#ifndef RKMH_DECOMPRESS_HPP
+#define RKMH_DECOMPRESS_HPP
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <zlib.h>
+#include <omp.h>
+#include "kseq_reader.hpp"
+
+using namespace std;
+
+/**
+ * Decompresses a FASTA/FASTQ file (BGZF, gzip or plain; "-" for STDIN)
+ * on a dedicated background thread, keeping up to readahead chunks
+ * of inflated data queued ahead of the consumer.
+ *
+ * BGZF input is inflated block-parallel: groups of blocks are read
+ * and then inflated by an OpenMP team of inflate_threads threads.
+ * Plain gzip can't be split, so it gets one inflating thread that
+ * at least runs concurrently with the parser and the hashing workers.
+ */
+class InflateStream{
+    public:
+        InflateStream(const char* filename, int inflate_threads = 1, int readahead = 8){
+            this->inflate_threads = inflate_threads < 1 ? 1 : inflate_threads;
+            this->readahead = readahead < 1 ? 1 : readahead;
+
+            bool from_stdin = strcmp(filename, "-") == 0;
+            if (!from_stdin && is_bgzf(filename)){
+                FILE* fp = fopen(filename, "rb");
+                worker = std::thread(&InflateStream::run_bgzf, this, fp);
+            }
+            else{
+                gzFile fp = from_stdin ? gzdopen(fileno(stdin), "r") : gzopen(filename, "r");
+                if (fp == NULL){
+                    cerr << "Could not open " << filename << endl;
+                    exit(1);
+                }
+                worker = std::thread(&InflateStream::run_gzip, this, fp);
+            }
+        };
+
+        ~InflateStream(){
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stop = true;
+            }
+            not_full.notify_all();
+            worker.join();
+        };
+
+        /**
+         * gzread-alike: fills buf with len bytes unless the input ends first.
+         * Returns the number of bytes copied, 0 at end of input and -1 on error.
+         */
+        inline int read(void* buf, int len){
+            char* out = (char*) buf;
+            int copied = 0;
+            while (copied < len){
+                if (current_pos >= current.size() && !next_chunk()){
+                    break;
+                }
+                int n = std::min((size_t) (len - copied), current.size() - current_pos);
+                memcpy(out + copied, current.data() + current_pos, n);
+                current_pos += n;
+                copied += n;
+            }
+            if (copied == 0 && failed){
+                return -1;
+            }
+            return copied;
+        };
+
+        /** Returns true if filename starts with a BGZF block header. */
+        static inline bool is_bgzf(const char* filename){
+            FILE* fp = fopen(filename, "rb");
+            if (fp == NULL){
+                return false;
+            }
+            unsigned char h[18];
+            bool ret = fread(h, 1, 18, fp) == 18 &&
+                h[0] == 31 && h[1] == 139 && h[2] == 8 && (h[3] & 4) &&
+                h[10] == 6 && h[11] == 0 && h[12] == 'B' && h[13] == 'C';
+            fclose(fp);
+            return ret;
+        };
+
+    private:
+        int inflate_threads;
+        int readahead;
+        std::thread worker;
+        std::mutex mtx;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        deque<vector<char> > chunks;
+        bool done = false;
+        bool stop = false;
+        bool failed = false;
+
+        // consumer-side only; no locking needed
+        vector<char> current;
+        size_t current_pos = 0;
+
+        int chunk_size = 1 << 22;
+
+        inline bool next_chunk(){
+            std::unique_lock<std::mutex> lock(mtx);
+            not_empty.wait(lock, [this]{ return !chunks.empty() || done; });
+            if (chunks.empty()){
+                return false;
+            }
+            current.swap(chunks.front());
+            chunks.pop_front();
+            current_pos = 0;
+            lock.unlock();
+            not_full.notify_one();
+            return true;
+        };
+
+        // Blocks while the read-ahead queue is full. Returns false if the consumer has gone away.
+        inline bool push(vector<char>& c){
+            std::unique_lock<std::mutex> lock(mtx);
+            not_full.wait(lock, [this]{ return chunks.size() < (size_t) readahead || stop; });
+            if (stop){
+                return false;
+            }
+            chunks.emplace_back();
+            chunks.back().swap(c);
+            lock.unlock();
+            not_empty.notify_one();
+            return true;
+        };
+
+        inline void finish(bool error){
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                done = true;
+                failed = error;
+            }
+            not_empty.notify_all();
+        };
+
+        void run_gzip(gzFile fp){
+            gzbuffer(fp, 1 << 17);
+            bool error = false;
+            while (true){
+                vector<char> c(chunk_size);
+                int n = gzread(fp, c.data(), chunk_size);
+                if (n < 0){
+                    error = true;
+                    break;
+                }
+                if (n == 0){
+                    break;
+                }
+                c.resize(n);
+                if (!push(c)){
+                    break;
+                }
+            }
+            gzclose(fp);
+            finish(error);
+        };
+
+        /**
+         * Read one compressed BGZF block (header, CDATA, CRC32 and ISIZE) into block.
+         * Returns 1 on success, 0 at a clean end of file and -1 on a malformed block.
+         */
+        static inline int read_bgzf_block(FILE* fp, vector<unsigned char>& block){
+            block.resize(12);
+            size_t n = fread(block.data(), 1, 12, fp);
+            if (n == 0){
+                return 0;
+            }
+            if (n != 12 || block[0] != 31 || block[1] != 139 || !(block[3] & 4)){
+                return -1;
+            }
+            int xlen = block[10] | (block[11] << 8);
+            block.resize(12 + xlen);
+            if (fread(block.data() + 12, 1, xlen, fp) != (size_t) xlen){
+                return -1;
+            }
+            int bsize = -1;
+            for (int i = 12; i + 4 <= 12 + xlen; ){
+                int slen = block[i + 2] | (block[i + 3] << 8);
+                if (block[i] == 'B' && block[i + 1] == 'C' && slen == 2){
+                    bsize = block[i + 4] | (block[i + 5] << 8);
+                }
+                i += 4 + slen;
+            }
+            if (bsize < 12 + xlen + 8){
+                return -1;
+            }
+            int total = bsize + 1;
+            block.resize(total);
+            if (fread(block.data() + 12 + xlen, 1, total - 12 - xlen, fp) != (size_t) (total - 12 - xlen)){
+                return -1;
+            }
+            return 1;
+        };
+
+        // Raw-inflate the CDATA of one BGZF block into out.
+        static inline bool inflate_bgzf_block(vector<unsigned char>& block, vector<char>& out){
+            int xlen = block[10] | (block[11] << 8);
+            int total = block.size();
+            uint32_t isize = block[total - 4] | (block[total - 3] << 8) |
+                (block[total - 2] << 16) | ((uint32_t) block[total - 1] << 24);
+            out.resize(isize);
+            if (isize == 0){
+                return true;
+            }
+            z_stream zs;
+            memset(&zs, 0, sizeof(zs));
+            if (inflateInit2(&zs, -15) != Z_OK){
+                return false;
+            }
+            zs.next_in = block.data() + 12 + xlen;
+            zs.avail_in = total - 12 - xlen - 8;
+            zs.next_out = (Bytef*) out.data();
+            zs.avail_out = isize;
+            int ret = inflate(&zs, Z_FINISH);
+            inflateEnd(&zs);
+            return ret == Z_STREAM_END && zs.total_out == isize;
+        };
+
+        void run_bgzf(FILE* fp){
+            // ~64 blocks per thread per group, i.e. a few MB of output at a time
+            int group = 64 * inflate_threads;
+            vector<vector<unsigned char> > blocks(group);
+            vector<vector<char> > inflated(group);
+            bool error = false;
+            bool eof = false;
+            while (!eof && !error){
+                int nblocks = 0;
+                while (nblocks < group){
+                    int r = read_bgzf_block(fp, blocks[nblocks]);
+                    if (r == 0){
+                        eof = true;
+                        break;
+                    }
+                    if (r < 0){
+                        error = true;
+                        break;
+                    }
+                    ++nblocks;
+                }
+                bool bad = false;
+                #pragma omp parallel for num_threads(inflate_threads) schedule(dynamic, 4) reduction(||:bad)
+                for (int i = 0; i < nblocks; ++i){
+                    bad = bad || !inflate_bgzf_block(blocks[i], inflated[i]);
+                }
+                if (bad){
+                    error = true;
+                    break;
+                }
+                size_t sz = 0;
+                for (int i = 0; i < nblocks; ++i){
+                    sz += inflated[i].size();
+                }
+                vector<char> c;
+                c.reserve(sz);
+                for (int i = 0; i < nblocks; ++i){
+                    c.insert(c.end(), inflated[i].begin(), inflated[i].end());
+                }
+                if (!c.empty() && !push(c)){
+                    break;
+                }
+            }
+            if (error){
+                cerr << "Malformed BGZF block; stopping." << endl;
+            }
+            fclose(fp);
+            finish(error);
+        };
+};
+
+inline int inflate_stream_read(InflateStream* s, void* buf, int len){
+    return s->read(buf, len);
+}
+
+// A kseq parser over an InflateStream, kept in its own namespace so that
+// it doesn't collide with the gzFile instantiation in kseq_reader.
+namespace inflate_kseq{
+    KSEQ_INIT(InflateStream*, inflate_stream_read)
+}
+
+#endif
@@ -12,6 +12,11 @@
 #include <omp.h>
 #include "mkmh.hpp"
 #include "HASHTCounter.hpp"
+#include "bottom_sketch.hpp"
+#include "ref_index.hpp"
+#include "intersect.hpp"
+#include "sketch_matrix.hpp"
+#include "top_two.hpp"
 
 
 using namespace std;
@@ -265,8 +270,8 @@ inline vector<int> all_count(vector<hash_t> read_hashes, vector<pair<string, vec
     vector<int> ret(ref_to_hashes.size(), 0);
     #pragma omp parallel for
     for (int i = 0; i < ref_to_hashes.size(); i++){
-         vector<hash_t> matches = hash_intersection(read_hashes, ref_to_hashes[i].second);
-         ret[i] = matches.size();
+         ret[i] = hash_intersection_count(read_hashes.data(), read_hashes.size(),
+                 ref_to_hashes[i].second.data(), ref_to_hashes[i].second.size());
     }
     return ret;
     //return std::make_tuple(sample, shared_intersection, total_union);   
@@ -279,11 +284,11 @@ inline tuple<string, int, int> classify_and_count(vector<hash_t>& read_mins, vec
     int total_union = 0;
     
     for (int i = 0; i < ref_mins.size(); i++){
-        vector<hash_t> matches = hash_intersection(read_mins, ref_mins[i]);
-        if (matches.size() > max_shared){
-            max_shared = matches.size();
+        int shared = hash_intersection_count(read_mins.data(), read_mins.size(), ref_mins[i].data(), ref_mins[i].size());
+        if (shared > max_shared){
+            max_shared = shared;
             sample = ref_keys[i];
-            shared_inter = matches.size();
+            shared_inter = shared;
             total_union = read_mins.size() < ref_mins[i].size() ? read_mins.size() : ref_mins[i].size();
         }
     }
@@ -305,15 +310,14 @@ inline tuple<string, int, int> classify_and_count(vector<string> ref_keys, vecto
      *                                                                                                                          int sketch_size){
      * */
     for (int i = 0; i < ref_keys.size(); i++){
-        std::tuple<hash_t*, int> inter = hash_intersection(ref_mins[i], ref_starts[i], ref_lens[i], read_mins, read_start, read_len, sketch_size);
-        int shared = std::get<1>(inter);
+        int shared = std::min(sketch_size, (int) hash_intersection_count(ref_mins[i] + ref_starts[i], ref_lens[i] - ref_starts[i],
+                    read_mins + read_start, read_len - read_start));
         if (shared > max_shared){
             max_shared = shared;
             sample = ref_keys[i];
             shared_inter = shared;
             total_union = read_len < ref_lens[i] ? read_len : ref_lens[i];
         }
-        delete [] std::get<0>(inter);
 
     }
     return std::make_tuple(sample, shared_inter, total_union);
@@ -324,7 +328,8 @@ inline tuple<string, int, int> classify_and_count(vector<string> ref_keys, vecto
 inline tuple<string, int, int, bool> classify_and_count_diff_filter(vector<string> ref_keys, vector<hash_t*> ref_mins, hash_t* read_mins,
                                                     int* ref_starts, int read_start,
                                                     int* ref_lens, int read_len,
-                                                    int sketch_size, int min_diff){
+                                                    int sketch_size, int min_diff,
+                                                    sketch_scheme_t sketch_scheme = SKETCH_BOTTOM){
     int max_shared = 0;
     int prev_best = 0;
     string sample = "";
@@ -337,8 +342,15 @@ inline tuple<string, int, int, bool> classify_and_count_diff_filter(vector<strin
      *                                                                                                                          int sketch_size){
      * */
     for (int i = 0; i < ref_keys.size(); i++){
-        std::tuple<hash_t*, int> inter = hash_intersection(ref_mins[i], ref_starts[i], ref_lens[i], read_mins, read_start, read_len, sketch_size);
-        int shared = std::get<1>(inter);
+        int shared;
+        // one-permutation sketches are compared slot by slot, not as sorted sets
+        if (sketch_scheme != SKETCH_BOTTOM){
+            shared = one_perm_shared(ref_mins[i] + ref_starts[i], read_mins + read_start, std::min(ref_lens[i], read_len));
+        }
+        else{
+            shared = std::min(sketch_size, (int) hash_intersection_count(ref_mins[i] + ref_starts[i], ref_lens[i] - ref_starts[i],
+                        read_mins + read_start, read_len - read_start));
+        }
         if (shared > max_shared){
             prev_best = max_shared;
             max_shared = shared;
@@ -346,11 +358,54 @@ inline tuple<string, int, int, bool> classify_and_count_diff_filter(vector<strin
             shared_inter = shared;
             total_union = read_len < ref_lens[i] ? read_len : ref_lens[i];
         }
-        delete [] std::get<0>(inter);
 
     }
     return std::make_tuple(sample, shared_inter, total_union, (max_shared - prev_best > min_diff));
 };
+
+/**
+ * classify_and_count_diff_filter against a sketch matrix, slot by slot for
+ * one-permutation sketches, by sorted intersection otherwise. References
+ * that can't reach the runner-up are cut short (see top_two_scores). hint,
+ * if given, is the row to score first, and is set to the best row.
+ */
+inline tuple<string, int, int, bool> classify_and_count_diff_filter(const SketchMatrix& refs,
+                                                    const hash_t* read_mins, int read_len,
+                                                    int sketch_size, int min_diff,
+                                                    sketch_scheme_t sketch_scheme = SKETCH_BOTTOM,
+                                                    int* hint = NULL){
+    top_two_t top = top_two_scores(refs, read_mins, read_len, sketch_size, sketch_scheme,
+            hint != NULL ? *hint : 0, 0, min_diff);
+    if (top.best_id < 0){
+        return std::make_tuple(string(""), 0, 0, false);
+    }
+    if (hint != NULL){
+        *hint = top.best_id;
+    }
+    return std::make_tuple(refs.name(top.best_id), top.best, std::min(read_len, refs.row_len(top.best_id)),
+            top.best - top.second > min_diff);
+};
+
+/**
+ * classify_and_count_diff_filter for bottom sketches, counting shared hashes
+ * through an index of the matrix's rows rather than intersecting the read
+ * with each in turn. shared is scratch for index.refs() counts.
+ */
+inline tuple<string, int, int, bool> classify_and_count_diff_filter(const SketchMatrix& refs, const RefIndex& index,
+                                                    const hash_t* read_mins, int read_len,
+                                                    int min_diff, int* shared){
+    top_two_t top(0);
+    index.count(read_mins, read_len, shared);
+    for (int i = 0; i < refs.size(); i++){
+        top.offer(i, shared[i]);
+    }
+    if (top.best_id < 0){
+        return std::make_tuple(string(""), 0, 0, false);
+    }
+    return std::make_tuple(refs.name(top.best_id), top.best, std::min(read_len, refs.row_len(top.best_id)),
+            top.best - top.second > min_diff);
+};
+
 inline tuple<string, int, int> classify_and_count_par(vector<string>& ref_keys, vector<hash_t*>& ref_mins, hash_t* read_mins,
                                                     int* ref_starts, int& read_start,
                                                     int* ref_lens, int& read_len,
@@ -361,15 +416,14 @@ inline tuple<string, int, int> classify_and_count_par(vector<string>& ref_keys,
     int total_union = 0;
   
     for (int i = 0; i < ref_keys.size(); i++){
-        std::tuple<hash_t*, int> inter = hash_intersection(ref_mins[i], ref_starts[i], ref_lens[i], read_mins, read_start, read_len, sketch_size);
-        int shared = std::get<1>(inter);
+        int shared = std::min(sketch_size, (int) hash_intersection_count(ref_mins[i] + ref_starts[i], ref_lens[i] - ref_starts[i],
+                    read_mins + read_start, read_len - read_start));
         if (shared > max_shared){
             sample = ref_keys[i];
             max_shared = shared;
             shared_inter = shared;
             total_union = read_len < ref_lens[i] ? read_len : ref_lens[i];
         }
-        delete [] std::get<0>(inter);
 
     }
     return std::make_tuple(sample, shared_inter, total_union);
@@ -386,12 +440,11 @@ inline tuple<string, int, int> classify_and_count(vector<hash_t>& read_hashes, m
     int total_union = 0;
     map<string, vector<hash_t> >::iterator iter;
     for (iter = ref_to_hashes.begin(); iter != ref_to_hashes.end(); iter++){
-         vector<hash_t> matches = hash_intersection(read_hashes, iter->second);
-         //cerr << "MATCHES: " << matches.size() << endl;
-         if (matches.size() > max_shared){
-            max_shared = matches.size();
+         int shared = hash_intersection_count(read_hashes.data(), read_hashes.size(), iter->second.data(), iter->second.size());
+         if (shared > max_shared){
+            max_shared = shared;
             sample = iter->first;
-            shared_intersection = matches.size();
+            shared_intersection = shared;
             total_union = read_hashes.size(); //hash_union(read_hashes, iter->second).size();
 
             //cerr << "Matches now: " << matches.size() << " " << sample << endl;
@@ -410,13 +463,13 @@ inline tuple<string, int, int> p_classify_and_count(vector<hash_t>& read_hashes,
     vector<pair<string, vector<hash_t> > > ref_pairs(ref_to_hashes.begin(), ref_to_hashes.end());
     #pragma omp parallel for
     for (int i = 0; i < ref_pairs.size(); i++){
-         vector<hash_t> matches = hash_intersection(read_hashes, ref_pairs[i].second);
+         int shared = hash_intersection_count(read_hashes.data(), read_hashes.size(), ref_pairs[i].second.data(), ref_pairs[i].second.size());
          #pragma omp critical
          {
-         if (matches.size() > max_shared){
-            max_shared = matches.size();
+         if (shared > max_shared){
+            max_shared = shared;
             sample = ref_pairs[i].first;
-            shared_intersection = matches.size();
+            shared_intersection = shared;
             total_union = read_hashes.size(); //hash_union(read_hashes, iter->second).size();
          }
          }
@@ -448,7 +501,7 @@ inline vector<int> all_hash_compare(vector<hash_t>& hashes, vector<pair<string,
     vector<int> ret(ref_hashes.size(), 0);
     #pragma omp for
     for (int i = 0; i < ret.size(); i++){
-        ret[i] = hash_intersection(hashes, ref_hashes[i].second).size();
+        ret[i] = hash_intersection_count(hashes.data(), hashes.size(), ref_hashes[i].second.data(), ref_hashes[i].second.size());
     }
 
     return ret;
@@ -462,10 +515,10 @@ inline string classify(vector<hash_t>& read_hashes, map<string, vector<hash_t> >
     string ret = "";
     map<string, vector<hash_t> >::iterator iter;
     for (iter = ref_to_hashes.begin(); iter != ref_to_hashes.end(); iter++){
-         vector<hash_t> matches = hash_intersection(read_hashes, iter->second);
-         if (matches.size() > max_shared){
+         int shared = hash_intersection_count(read_hashes.data(), read_hashes.size(), iter->second.data(), iter->second.size());
+         if (shared > max_shared){
             ret = iter->first;
-            max_shared = matches.size();
+            max_shared = shared;
          }
     }
     return ret;
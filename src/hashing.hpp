@@ -0,0 +1,764 @@
+#ifndef RKMH_HASHING_HPP
+#define RKMH_HASHING_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "mkmh.hpp"
+#include "murmur3.hpp"
+#include "HASHTCounter.hpp"
+#include "mmap_reader.hpp"
+#include "simd_hash.hpp"
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * How a kmer and its reverse complement are reduced to one canonical hash.
+ * rkmh hashes both strands and keeps the smaller hash; Mash and sourmash
+ * hash only the lexicographically smaller strand. Sketches built one way
+ * share almost nothing with sketches built the other.
+ */
+enum canonical_mode_t{
+    CANONICAL_MIN_HASH,
+    CANONICAL_LEXICOGRAPHIC
+};
+
+/**
+ * The function kmers are hashed with.
+ * HASH_MURMUR3 is MurmurHash3_x64_128 (seed 42) over the kmer's bases,
+ * as in mkmh, Mash and sourmash. HASH_ROLLING packs each kmer (k <= 32)
+ * into a 64-bit word, two bits per base, updated in O(1) per base as the
+ * window slides, and hashes the word with an integer mixer. The two
+ * give unrelated hashes, so everything compared in a run must use one.
+ */
+enum hash_fn_t{
+    HASH_MURMUR3,
+    HASH_ROLLING
+};
+
+/** Everything that decides which hash a kmer gets. */
+struct hash_scheme_t{
+    hash_fn_t fn = HASH_MURMUR3;
+    canonical_mode_t canonical = CANONICAL_MIN_HASH;
+};
+
+inline const char* hash_fn_name(hash_fn_t fn){
+    return fn == HASH_ROLLING ? "rolling" : "murmur";
+}
+
+/** Parse a -H argument ("murmur" or "rolling"). Returns false if name is neither. */
+inline bool parse_hash_fn(const char* name, hash_fn_t& fn){
+    if (strcmp(name, "murmur") == 0){
+        fn = HASH_MURMUR3;
+        return true;
+    }
+    if (strcmp(name, "rolling") == 0){
+        fn = HASH_ROLLING;
+        return true;
+    }
+    return false;
+}
+
+/** Exit if scheme can't hash kmers of every size in kmer. */
+inline void check_kmer_sizes(const hash_scheme_t& scheme, const vector<int>& kmer){
+    for (auto k : kmer){
+        if (scheme.fn == HASH_ROLLING && k > 32){
+            cerr << "Rolling hashes (-H rolling) need kmers of at most 32 bases; got " << k << "." << endl;
+            exit(1);
+        }
+    }
+}
+
+/** A view over an in-memory sequence, e.g. one already copied out of the parser. */
+inline seq_view_t buffer_view(const char* seq, int len){
+    seq_view_t v;
+    v.seq = seq;
+    v.seq_span = len;
+    v.seq_len = len;
+    return v;
+}
+
+/** How many hashes calc_hashes gives a sequence of len bases (len - k, as in mkmh). */
+inline int num_kmer_hashes(int len, int k){
+    return len - k > 0 ? len - k : 0;
+}
+
+inline int num_kmer_hashes(int len, const vector<int>& kmer){
+    int n = 0;
+    for (auto k : kmer){
+        n += num_kmer_hashes(len, k);
+    }
+    return n;
+}
+
+/** 2-bit code of a base (A, C, G, T in either case), or 4 for anything else. */
+inline uint64_t base_code(char c){
+    switch (c){
+        case 'A': case 'a': return 0;
+        case 'C': case 'c': return 1;
+        case 'G': case 'g': return 2;
+        case 'T': case 't': return 3;
+        default: return 4;
+    }
+}
+
+/**
+ * The canonical rolling hash of a kmer from its forward and reverse-complement words.
+ * With A < C < G < T coded 0..3, the smaller word is the lexicographically smaller strand.
+ */
+inline hash_t canonical_rolling_hash(uint64_t fwd, uint64_t rev, int k, canonical_mode_t canonical){
+    if (canonical == CANONICAL_LEXICOGRAPHIC){
+        return mix_kmer(fwd < rev ? fwd : rev, k);
+    }
+    hash_t f = mix_kmer(fwd, k);
+    hash_t r = mix_kmer(rev, k);
+    return f < r ? f : r;
+}
+
+// Hashes are handed to the emit callbacks below in blocks of at most this many.
+#define RKMH_HASH_BLOCK 256
+
+inline uint64_t murmur_rotl64(uint64_t x, int r){
+    return (x << r) | (x >> (64 - r));
+}
+
+inline uint64_t murmur_fmix64(uint64_t x){
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    x ^= x >> 33;
+    return x;
+}
+
+/**
+ * The first 64 bits of MurmurHash3_x64_128 (seed 42) of K bytes, i.e. the
+ * hash calc_hashes gives a kmer. With the length a template parameter the
+ * block loop and the tail are laid out at compile time and the whole
+ * hash inlines into the kernels below.
+ */
+template<int K>
+inline hash_t murmur3_kmer(const char* key){
+    const uint8_t* data = (const uint8_t*) key;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = 42;
+    uint64_t h2 = 42;
+    for (int i = 0; i < K / 16; ++i){
+        uint64_t k1;
+        uint64_t k2;
+        memcpy(&k1, data + 16 * i, 8);
+        memcpy(&k2, data + 16 * i + 8, 8);
+        k1 *= c1; k1 = murmur_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = murmur_rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+        k2 *= c2; k2 = murmur_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = murmur_rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+    const uint8_t* tail = data + 16 * (K / 16);
+    const int rem = K & 15;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    for (int i = rem - 1; i >= 8; --i){
+        k2 ^= ((uint64_t) tail[i]) << (8 * (i - 8));
+    }
+    if (rem > 8){
+        k2 *= c2; k2 = murmur_rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+    }
+    for (int i = (rem < 8 ? rem : 8) - 1; i >= 0; --i){
+        k1 ^= ((uint64_t) tail[i]) << (8 * i);
+    }
+    if (rem > 0){
+        k1 *= c1; k1 = murmur_rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+    h1 ^= K;
+    h2 ^= K;
+    h1 += h2;
+    h2 += h1;
+    h1 = murmur_fmix64(h1);
+    h2 = murmur_fmix64(h2);
+    return h1 + h2;
+}
+
+/** Hash a kmer of k bytes: through murmur3_kmer<K> if K is set, else MurmurHash3 itself. */
+template<int K>
+inline hash_t murmur_kmer_hash(const char* key, int k){
+    if (K > 0){
+        return murmur3_kmer<K>(key);
+    }
+    uint32_t h[4];
+    MurmurHash3_x64_128(key, k, 42, h);
+    hash_t ret;
+    memcpy(&ret, h, sizeof(ret));
+    return ret;
+}
+
+/** murmur_kmer_hash for a k only known at runtime, using the compiled sizes where there is one. */
+inline hash_t murmur_kmer_hash_any(const char* key, int k){
+    switch (k){
+        case 12: return murmur3_kmer<12>(key);
+        case 15: return murmur3_kmer<15>(key);
+        case 16: return murmur3_kmer<16>(key);
+        case 18: return murmur3_kmer<18>(key);
+        case 20: return murmur3_kmer<20>(key);
+        case 21: return murmur3_kmer<21>(key);
+        case 31: return murmur3_kmer<31>(key);
+        default: return murmur_kmer_hash<0>(key, k);
+    }
+}
+
+/**
+ * Hash every kmer of a view with MurmurHash3 without copying the sequence,
+ * calling emit(const hash_t* h, int n) on each block of consecutive hashes.
+ * Uppercasing and newline stripping happen as the bases stream
+ * past; only the current kmer (and its reverse complement) is kept,
+ * in double-written windows of 2k bytes so each is always contiguous.
+ *
+ * Produces exactly what calc_hashes does on the uppercased,
+ * newline-stripped sequence: canonical MurmurHash3_x64_128 (seed 42),
+ * 0 for kmers with non-ACGT bases, and seq_len - k hashes.
+ * With CANONICAL_LEXICOGRAPHIC, only the smaller strand is hashed, as Mash does.
+ *
+ * K > 0 compiles the kernel for kmers of exactly K bases (kmer_size must
+ * equal it), so window offsets and the hash itself use constants; K = 0
+ * is the generic kernel. for_each_hash picks between them.
+ */
+template<int K = 0, typename EMIT>
+inline void murmur_hashes_each(const seq_view_t& v, const int& kmer_size,
+        canonical_mode_t canonical, EMIT emit){
+    const int k = K > 0 ? K : kmer_size;
+    int numhashes = num_kmer_hashes(v.seq_len, k);
+    if (numhashes == 0){
+        return;
+    }
+
+    hash_t block[RKMH_HASH_BLOCK];
+    int filled = 0;
+    char fwd[2 * k];
+    char rev[2 * k];
+    int valid = 0;
+    int j = 0;
+    for (const char* p = v.seq; p < v.seq + v.seq_span && j - k + 1 < numhashes; ++p){
+        char c = *p;
+        if (!isgraph(c)){
+            continue;
+        }
+        c = toupper(c);
+        char cc;
+        switch (c){
+            case 'A': cc = 'T'; ++valid; break;
+            case 'C': cc = 'G'; ++valid; break;
+            case 'G': cc = 'C'; ++valid; break;
+            case 'T': cc = 'A'; ++valid; break;
+            default: cc = 'N'; valid = 0;
+        }
+        int f = j % k;
+        int r = (k - f) % k;
+        fwd[f] = fwd[f + k] = c;
+        rev[r] = rev[r + k] = cc;
+
+        if (j - k + 1 >= 0){
+            hash_t h = 0;
+            if (valid >= k && canonical == CANONICAL_LEXICOGRAPHIC){
+                const char* kf = fwd + (f + 1) % k;
+                const char* kr = rev + r;
+                h = murmur_kmer_hash<K>(memcmp(kr, kf, k) < 0 ? kr : kf, k);
+            }
+            else if (valid >= k){
+                hash_t tmp_fwd = murmur_kmer_hash<K>(fwd + (f + 1) % k, k);
+                hash_t tmp_rev = murmur_kmer_hash<K>(rev + r, k);
+                h = (tmp_fwd < tmp_rev ? tmp_fwd : tmp_rev);
+            }
+            block[filled] = h;
+            if (++filled == RKMH_HASH_BLOCK){
+                emit((const hash_t*) block, filled);
+                filled = 0;
+            }
+        }
+        ++j;
+    }
+    if (filled > 0){
+        emit((const hash_t*) block, filled);
+    }
+}
+
+/**
+ * Rolling 2-bit hashes of every kmer of a view (k <= 32), emitted as
+ * murmur_hashes_each does: seq_len - k hashes, 0 for kmers with non-ACGT bases.
+ * The forward word shifts each base in at the bottom and the reverse
+ * complement word shifts its complement in at the top. Words are packed
+ * a block at a time and then mixed together (see mix_kmer_words).
+ * K is as for murmur_hashes_each: with it set, the mask and shifts are constants.
+ */
+template<int K = 0, typename EMIT>
+inline void rolling_hashes_each(const seq_view_t& v, const int& kmer_size,
+        canonical_mode_t canonical, EMIT emit, hash_isa_t isa = best_hash_isa()){
+    const int k = K > 0 ? K : kmer_size;
+    int numhashes = num_kmer_hashes(v.seq_len, k);
+    if (numhashes == 0){
+        return;
+    }
+
+    const int run = RKMH_HASH_BLOCK;
+    uint64_t fwd_words[run];
+    uint64_t rev_words[run];
+    bool ok[run];
+    hash_t out[run];
+    int filled = 0;
+    auto flush = [&](){
+        if (filled == 0){
+            return;
+        }
+        mix_kmer_words(fwd_words, rev_words, filled, k, canonical == CANONICAL_LEXICOGRAPHIC, out, isa);
+        for (int i = 0; i < filled; ++i){
+            if (!ok[i]){
+                out[i] = 0;
+            }
+        }
+        emit((const hash_t*) out, filled);
+        filled = 0;
+    };
+
+    const uint64_t mask = k == 32 ? ~((uint64_t) 0) : (((uint64_t) 1) << (2 * k)) - 1;
+    const int shift = 2 * (k - 1);
+    uint64_t fwd = 0;
+    uint64_t rev = 0;
+    int valid = 0;
+    int j = 0;
+    for (const char* p = v.seq; p < v.seq + v.seq_span && j - k + 1 < numhashes; ++p){
+        if (!isgraph(*p)){
+            continue;
+        }
+        uint64_t b = base_code(*p);
+        if (b > 3){
+            // the invalid base is shifted out before valid reaches k again
+            b = 0;
+            valid = 0;
+        }
+        else{
+            ++valid;
+        }
+        fwd = ((fwd << 2) | b) & mask;
+        rev = (rev >> 2) | ((3 - b) << shift);
+
+        if (j - k + 1 >= 0){
+            fwd_words[filled] = fwd;
+            rev_words[filled] = rev;
+            ok[filled] = valid >= k;
+            if (++filled == run){
+                flush();
+            }
+        }
+        ++j;
+    }
+    flush();
+}
+
+/** Per-kmer-size state of the single-pass multi-k kernels below. */
+struct k_block_t{
+    int k;
+    int numhashes;
+    int filled;
+    // the size's words are cut out of the largest size's words
+    uint64_t mask;
+    int drop;
+    uint64_t fwd[RKMH_HASH_BLOCK];
+    uint64_t rev[RKMH_HASH_BLOCK];
+    bool ok[RKMH_HASH_BLOCK];
+    hash_t hashes[RKMH_HASH_BLOCK];
+};
+
+/**
+ * The calling thread's k_block_t's for the kmer sizes in kmer, reset.
+ * Reused across calls, so the kernels must not be nested on one thread.
+ */
+inline k_block_t* thread_k_blocks(const vector<int>& kmer){
+    static thread_local vector<k_block_t> blocks;
+    if (blocks.size() < kmer.size()){
+        blocks.resize(kmer.size());
+    }
+    int kmax = *std::max_element(kmer.begin(), kmer.end());
+    for (size_t i = 0; i < kmer.size(); ++i){
+        int k = kmer[i];
+        blocks[i].k = k;
+        blocks[i].filled = 0;
+        blocks[i].mask = k == 32 ? ~((uint64_t) 0) : (((uint64_t) 1) << (2 * k)) - 1;
+        blocks[i].drop = 2 * (kmax - k);
+    }
+    return blocks.data();
+}
+
+/**
+ * MurmurHash3 hashes of a view for several kmer sizes in one pass over its
+ * bases, calling emit(int ki, const hash_t* h, int n) with blocks of
+ * consecutive hashes for size kmer[ki]. Each size gets exactly what
+ * murmur_hashes_each gives it. The window is kept for the largest size;
+ * a smaller kmer is the tail of its forward window and the head of its
+ * reverse-complement window.
+ */
+template<typename EMIT>
+inline void murmur_hashes_each_multi(const seq_view_t& v, const vector<int>& kmer,
+        canonical_mode_t canonical, EMIT emit){
+    const int nk = kmer.size();
+    k_block_t* blocks = thread_k_blocks(kmer);
+    int kmax = 0;
+    int last = 0;
+    for (int i = 0; i < nk; ++i){
+        blocks[i].numhashes = num_kmer_hashes(v.seq_len, kmer[i]);
+        kmax = std::max(kmax, kmer[i]);
+        // the window index j at which this size's last hash is made
+        last = std::max(last, blocks[i].numhashes + kmer[i] - 1);
+    }
+
+    char fwd[2 * kmax];
+    char rev[2 * kmax];
+    int valid = 0;
+    int j = 0;
+    for (const char* p = v.seq; p < v.seq + v.seq_span && j < last; ++p){
+        char c = *p;
+        if (!isgraph(c)){
+            continue;
+        }
+        c = toupper(c);
+        char cc;
+        switch (c){
+            case 'A': cc = 'T'; ++valid; break;
+            case 'C': cc = 'G'; ++valid; break;
+            case 'G': cc = 'C'; ++valid; break;
+            case 'T': cc = 'A'; ++valid; break;
+            default: cc = 'N'; valid = 0;
+        }
+        int f = j % kmax;
+        int r = (kmax - f) % kmax;
+        fwd[f] = fwd[f + kmax] = c;
+        rev[r] = rev[r + kmax] = cc;
+
+        for (int ki = 0; ki < nk; ++ki){
+            k_block_t& b = blocks[ki];
+            int k = b.k;
+            int start = j - k + 1;
+            if (start < 0 || start >= b.numhashes){
+                continue;
+            }
+            hash_t h = 0;
+            const char* kf = fwd + (f + 1) % kmax + kmax - k;
+            const char* kr = rev + r;
+            if (valid >= k && canonical == CANONICAL_LEXICOGRAPHIC){
+                h = murmur_kmer_hash_any(memcmp(kr, kf, k) < 0 ? kr : kf, k);
+            }
+            else if (valid >= k){
+                hash_t tmp_fwd = murmur_kmer_hash_any(kf, k);
+                hash_t tmp_rev = murmur_kmer_hash_any(kr, k);
+                h = (tmp_fwd < tmp_rev ? tmp_fwd : tmp_rev);
+            }
+            b.hashes[b.filled] = h;
+            if (++b.filled == RKMH_HASH_BLOCK){
+                emit(ki, (const hash_t*) b.hashes, b.filled);
+                b.filled = 0;
+            }
+        }
+        ++j;
+    }
+    for (int ki = 0; ki < nk; ++ki){
+        if (blocks[ki].filled > 0){
+            emit(ki, (const hash_t*) blocks[ki].hashes, blocks[ki].filled);
+        }
+    }
+}
+
+/**
+ * Rolling hashes of a view for several kmer sizes (each <= 32) in one pass,
+ * emitted as murmur_hashes_each_multi does. Only the largest size's words
+ * are rolled; each smaller size masks its forward word out of the bottom
+ * and shifts its reverse-complement word down from the top.
+ */
+template<typename EMIT>
+inline void rolling_hashes_each_multi(const seq_view_t& v, const vector<int>& kmer,
+        canonical_mode_t canonical, EMIT emit){
+    const int nk = kmer.size();
+    k_block_t* blocks = thread_k_blocks(kmer);
+    int kmax = 0;
+    int last = 0;
+    for (int i = 0; i < nk; ++i){
+        blocks[i].numhashes = num_kmer_hashes(v.seq_len, kmer[i]);
+        kmax = std::max(kmax, kmer[i]);
+        last = std::max(last, blocks[i].numhashes + kmer[i] - 1);
+    }
+    auto flush = [&](int ki){
+        k_block_t& b = blocks[ki];
+        mix_kmer_words(b.fwd, b.rev, b.filled, b.k, canonical == CANONICAL_LEXICOGRAPHIC, b.hashes);
+        for (int i = 0; i < b.filled; ++i){
+            if (!b.ok[i]){
+                b.hashes[i] = 0;
+            }
+        }
+        emit(ki, (const hash_t*) b.hashes, b.filled);
+        b.filled = 0;
+    };
+
+    const uint64_t mask = kmax == 32 ? ~((uint64_t) 0) : (((uint64_t) 1) << (2 * kmax)) - 1;
+    const int shift = 2 * (kmax - 1);
+    uint64_t fwd = 0;
+    uint64_t rev = 0;
+    int valid = 0;
+    int j = 0;
+    for (const char* p = v.seq; p < v.seq + v.seq_span && j < last; ++p){
+        if (!isgraph(*p)){
+            continue;
+        }
+        uint64_t b = base_code(*p);
+        if (b > 3){
+            b = 0;
+            valid = 0;
+        }
+        else{
+            ++valid;
+        }
+        fwd = ((fwd << 2) | b) & mask;
+        rev = (rev >> 2) | ((3 - b) << shift);
+
+        for (int ki = 0; ki < nk; ++ki){
+            k_block_t& kb = blocks[ki];
+            int start = j - kb.k + 1;
+            if (start < 0 || start >= kb.numhashes){
+                continue;
+            }
+            kb.fwd[kb.filled] = fwd & kb.mask;
+            kb.rev[kb.filled] = rev >> kb.drop;
+            kb.ok[kb.filled] = valid >= kb.k;
+            if (++kb.filled == RKMH_HASH_BLOCK){
+                flush(ki);
+            }
+        }
+        ++j;
+    }
+    for (int ki = 0; ki < nk; ++ki){
+        if (blocks[ki].filled > 0){
+            flush(ki);
+        }
+    }
+}
+
+template<int K, typename EMIT>
+inline void for_each_hash_k(const seq_view_t& v, const int& k, const hash_scheme_t& scheme, EMIT emit){
+    if (scheme.fn == HASH_ROLLING){
+        rolling_hashes_each<K>(v, k, scheme.canonical, emit);
+    }
+    else{
+        murmur_hashes_each<K>(v, k, scheme.canonical, emit);
+    }
+}
+
+/**
+ * Emit every hash of a view, in blocks (see murmur_hashes_each), without storing them.
+ * The kmer sizes in common use have kernels compiled for them; any other k
+ * takes the generic kernel. Both give the same hashes.
+ */
+template<typename EMIT>
+inline void for_each_hash(const seq_view_t& v, const int& k, const hash_scheme_t& scheme, EMIT emit){
+    switch (k){
+        case 12: for_each_hash_k<12>(v, k, scheme, emit); break;
+        case 15: for_each_hash_k<15>(v, k, scheme, emit); break;
+        case 16: for_each_hash_k<16>(v, k, scheme, emit); break;
+        case 18: for_each_hash_k<18>(v, k, scheme, emit); break;
+        case 20: for_each_hash_k<20>(v, k, scheme, emit); break;
+        case 21: for_each_hash_k<21>(v, k, scheme, emit); break;
+        case 31: for_each_hash_k<31>(v, k, scheme, emit); break;
+        default: for_each_hash_k<0>(v, k, scheme, emit);
+    }
+}
+
+/**
+ * Hashes of a view for every size in kmer, in one pass over its bases
+ * (see murmur_hashes_each_multi); emit(ki, h, n) is told which size each
+ * block is for. A single size goes to its compiled kernel, if it has one.
+ */
+template<typename EMIT>
+inline void for_each_hash_multi(const seq_view_t& v, const vector<int>& kmer, const hash_scheme_t& scheme, EMIT emit){
+    if (kmer.empty()){
+        return;
+    }
+    if (kmer.size() == 1){
+        for_each_hash(v, kmer[0], scheme, [&emit](const hash_t* h, int n){
+                emit(0, h, n);
+                });
+    }
+    else if (scheme.fn == HASH_ROLLING){
+        rolling_hashes_each_multi(v, kmer, scheme.canonical, emit);
+    }
+    else{
+        murmur_hashes_each_multi(v, kmer, scheme.canonical, emit);
+    }
+}
+
+/**
+ * Multiple kmer sizes, in one pass. Blocks of different sizes come
+ * interleaved, which is fine for anything that only looks at the
+ * set of hashes (sketches, counters).
+ */
+template<typename EMIT>
+inline void for_each_hash(const seq_view_t& v, const vector<int>& kmer, const hash_scheme_t& scheme, EMIT emit){
+    for_each_hash_multi(v, kmer, scheme, [&emit](int /*ki*/, const hash_t* h, int n){
+            emit(h, n);
+            });
+}
+
+/** Rolling hashes of a view into hashes, with the given mixing kernel (see rkmh_bench simd). */
+inline void rolling_hashes_into(const seq_view_t& v, const int& k, hash_t* hashes,
+        canonical_mode_t canonical, hash_isa_t isa = best_hash_isa()){
+    rolling_hashes_each(v, k, canonical, [&hashes](const hash_t* h, int n){
+            memcpy(hashes, h, n * sizeof(hash_t));
+            hashes += n;
+            }, isa);
+}
+
+/** Hash every kmer of a view into hashes, which must hold num_kmer_hashes(v.seq_len, k) values. */
+inline void calc_hashes_into(const seq_view_t& v, const int& k, hash_t* hashes,
+        const hash_scheme_t& scheme = hash_scheme_t()){
+    for_each_hash(v, k, scheme, [&hashes](const hash_t* h, int n){
+            memcpy(hashes, h, n * sizeof(hash_t));
+            hashes += n;
+            });
+}
+
+/** Multiple kmer sizes, in one pass: per-size hashes are concatenated, as in calc_hashes. */
+inline void calc_hashes_into(const seq_view_t& v, const vector<int>& kmer, hash_t* hashes,
+        const hash_scheme_t& scheme = hash_scheme_t()){
+    hash_t* outs[kmer.size()];
+    hash_t** out = outs;
+    for (size_t i = 0; i < kmer.size(); ++i){
+        outs[i] = hashes;
+        hashes += num_kmer_hashes(v.seq_len, kmer[i]);
+    }
+    for_each_hash_multi(v, kmer, scheme, [out](int ki, const hash_t* h, int n){
+            memcpy(out[ki], h, n * sizeof(hash_t));
+            out[ki] += n;
+            });
+}
+
+/** As calc_hashes_into, into a new array. */
+inline void calc_hashes(const seq_view_t& v, const int& k, hash_t*& hashes, int& numhashes,
+        const hash_scheme_t& scheme = hash_scheme_t()){
+    numhashes = num_kmer_hashes(v.seq_len, k);
+    hashes = new hash_t[numhashes];
+    calc_hashes_into(v, k, hashes, scheme);
+}
+
+inline void calc_hashes(const seq_view_t& v, const vector<int>& kmer, hash_t*& hashes, int& numhashes,
+        const hash_scheme_t& scheme = hash_scheme_t()){
+    numhashes = num_kmer_hashes(v.seq_len, kmer);
+    hashes = new hash_t[numhashes];
+    calc_hashes_into(v, kmer, hashes, scheme);
+}
+
+/**
+ * Hash an in-memory sequence with the given scheme;
+ * the default scheme is mkmh's calc_hashes.
+ */
+inline void calc_hashes(const char* seq, int len, vector<int>& kmer, hash_t*& hashes, int& numhashes,
+        const hash_scheme_t& scheme){
+    if (scheme.fn == HASH_MURMUR3 && scheme.canonical == CANONICAL_MIN_HASH){
+        calc_hashes(seq, len, kmer, hashes, numhashes);
+        return;
+    }
+    calc_hashes(buffer_view(seq, len), kmer, hashes, numhashes, scheme);
+}
+
+inline void calc_hashes(const char* seq, int len, int k, hash_t*& hashes, int& numhashes,
+        const hash_scheme_t& scheme){
+    if (scheme.fn == HASH_MURMUR3 && scheme.canonical == CANONICAL_MIN_HASH){
+        calc_hashes(seq, len, k, hashes, numhashes);
+        return;
+    }
+    calc_hashes(buffer_view(seq, len), k, hashes, numhashes, scheme);
+}
+
+/** As above, also counting every hash in htc. */
+inline void calc_hashes(const char* seq, int len, vector<int>& kmer, hash_t*& hashes, int& numhashes,
+        HASHTCounter* htc, const hash_scheme_t& scheme){
+    calc_hashes(seq, len, kmer, hashes, numhashes, scheme);
+    for (int i = 0; i < numhashes; ++i){
+        htc->increment(hashes[i]);
+    }
+}
+
+/** The canonical hash of a single kmer of k bases (0 if it has a non-ACGT base). */
+inline hash_t hash_kmer(const char* kmer, int k, const hash_scheme_t& scheme){
+    if (scheme.fn == HASH_MURMUR3 && scheme.canonical == CANONICAL_MIN_HASH){
+        return calc_hash((char*) kmer, k);
+    }
+    if (scheme.fn == HASH_ROLLING){
+        uint64_t fwd = 0;
+        uint64_t rev = 0;
+        for (int i = 0; i < k; ++i){
+            uint64_t b = base_code(kmer[i]);
+            if (b > 3){
+                return 0;
+            }
+            fwd = (fwd << 2) | b;
+            rev |= (3 - b) << (2 * i);
+        }
+        return canonical_rolling_hash(fwd, rev, k, scheme.canonical);
+    }
+    char fwd[k];
+    char rev[k];
+    for (int i = 0; i < k; ++i){
+        fwd[i] = toupper(kmer[i]);
+        switch (fwd[i]){
+            case 'A': rev[k - 1 - i] = 'T'; break;
+            case 'C': rev[k - 1 - i] = 'G'; break;
+            case 'G': rev[k - 1 - i] = 'C'; break;
+            case 'T': rev[k - 1 - i] = 'A'; break;
+            default: return 0;
+        }
+    }
+    uint32_t h[4];
+    MurmurHash3_x64_128(memcmp(rev, fwd, k) < 0 ? rev : fwd, k, 42, h);
+    hash_t ret;
+    memcpy(&ret, h, sizeof(ret));
+    return ret;
+}
+
+inline hash_t hash_kmer(const string& kmer, const hash_scheme_t& scheme){
+    return hash_kmer(kmer.c_str(), kmer.size(), scheme);
+}
+
+/**
+ * True if a kmer's canonical hash (see hash_kmer) comes from its reverse
+ * complement rather than the bases as given. Palindromes count as forward.
+ */
+inline bool kmer_on_reverse(const char* kmer, int k, const hash_scheme_t& scheme){
+    if (scheme.fn == HASH_ROLLING){
+        uint64_t fwd = 0;
+        uint64_t rev = 0;
+        for (int i = 0; i < k; ++i){
+            uint64_t b = base_code(kmer[i]) & 3;
+            fwd = (fwd << 2) | b;
+            rev |= (3 - b) << (2 * i);
+        }
+        if (scheme.canonical == CANONICAL_LEXICOGRAPHIC){
+            return rev < fwd;
+        }
+        return mix_kmer(rev, k) < mix_kmer(fwd, k);
+    }
+    char fwd[k];
+    char rev[k];
+    for (int i = 0; i < k; ++i){
+        fwd[i] = toupper(kmer[i]);
+        switch (fwd[i]){
+            case 'A': rev[k - 1 - i] = 'T'; break;
+            case 'C': rev[k - 1 - i] = 'G'; break;
+            case 'G': rev[k - 1 - i] = 'C'; break;
+            default: rev[k - 1 - i] = 'A'; break;
+        }
+    }
+    if (scheme.canonical == CANONICAL_LEXICOGRAPHIC){
+        return memcmp(rev, fwd, k) < 0;
+    }
+    return murmur_kmer_hash_any(rev, k) < murmur_kmer_hash_any(fwd, k);
+}
+
+#endif
@@ -0,0 +1,210 @@
+#ifndef RKMH_INTERSECT_HPP
+#define RKMH_INTERSECT_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include "mkmh.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * Count-only intersections of sorted hash arrays, allocating nothing.
+ * hash_intersection_count counts as hash_intersection_size does (a hash
+ * repeated in both arrays counts as often as the fewer repeats);
+ * hash_set_intersection_count as hash_set_intersection_size (each shared
+ * hash once).
+ *
+ * If one array is at least RKMH_GALLOP_RATIO times longer than the other
+ * (e.g. a read against a reference's full hash array), each hash of the
+ * shorter one is looked up in the longer one by galloping: steps doubling
+ * from where the last hash was found, then a binary search. The cost then
+ * follows the shorter array. Arrays of similar length are merged instead.
+ * With AVX2, the merge compares a block of four hashes from each array at
+ * once, all 16 pairs, and moves on whichever block ends lower, with no
+ * branch per hash.
+ */
+#define RKMH_GALLOP_RATIO 128
+
+/** The first index at or after lo whose hash is at least x (h is sorted). */
+inline uint64_t gallop_lower_bound(const hash_t* h, uint64_t n, uint64_t lo, hash_t x){
+    uint64_t hi = lo;
+    uint64_t step = 1;
+    while (hi < n && h[hi] < x){
+        lo = hi + 1;
+        hi += step;
+        step <<= 1;
+    }
+    return std::lower_bound(h + lo, h + std::min(hi, n), x) - h;
+}
+
+/** Intersection of a short array with a long one, each hash of short found by galloping. */
+inline uint64_t gallop_intersection_count(const hash_t* s, uint64_t ns, const hash_t* l, uint64_t nl, bool distinct){
+    uint64_t count = 0;
+    uint64_t p = 0;
+    for (uint64_t i = 0; i < ns && p < nl; ){
+        uint64_t r = 1;
+        while (i + r < ns && s[i + r] == s[i]){
+            ++r;
+        }
+        p = gallop_lower_bound(l, nl, p, s[i]);
+        uint64_t c = 0;
+        while (p + c < nl && l[p + c] == s[i]){
+            ++c;
+        }
+        count += distinct ? (c > 0) : std::min(r, c);
+        p += c;
+        i += r;
+    }
+    return count;
+}
+
+/** The plain merge, counting as hash_intersection_size does. */
+inline uint64_t merge_intersection_count(const hash_t* a, uint64_t na, const hash_t* b, uint64_t nb){
+    uint64_t count = 0;
+    uint64_t i = 0;
+    uint64_t j = 0;
+    while (i < na && j < nb){
+        hash_t x = a[i];
+        hash_t y = b[j];
+        count += x == y;
+        i += x <= y;
+        j += y <= x;
+    }
+    return count;
+}
+
+/**
+ * Shared hashes of a and b from index i and j on, counting only the
+ * first copy of each hash in each array. Copies before i or j are
+ * taken to have been counted already (see set_intersection_count_avx2).
+ * repeats, if given, is set if a shared hash is repeated in either array.
+ */
+inline uint64_t set_merge_count(const hash_t* a, uint64_t na, const hash_t* b, uint64_t nb,
+        uint64_t i = 0, uint64_t j = 0, bool* repeats = NULL){
+    uint64_t count = 0;
+    bool rep = false;
+    while (i < na && j < nb){
+        hash_t x = a[i];
+        hash_t y = b[j];
+        bool first = (i == 0 || a[i - 1] != x) && (j == 0 || b[j - 1] != y);
+        count += x == y && first;
+        rep |= x == y && !first;
+        i += x <= y;
+        j += y <= x;
+    }
+    if (repeats != NULL){
+        *repeats |= rep;
+    }
+    return count;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+// lanes of the block at h + i holding a repeat of the hash before them
+__attribute__((target("avx2")))
+inline __m256i repeat_lanes_avx2(const hash_t* h, uint64_t i, __m256i v){
+    __m256i prev = i == 0 ? _mm256_setr_epi64x(h[0] ^ 1, h[0], h[1], h[2]) :
+        _mm256_loadu_si256((const __m256i*) (h + i - 1));
+    return _mm256_cmpeq_epi64(v, prev);
+}
+
+/**
+ * set_merge_count four by four. A pair of blocks only counts hashes that
+ * are first copies in both, so repeats are never counted twice. The first
+ * copies of a shared hash always end up compared: a block is only passed
+ * over once the other array has reached a larger hash. repeats, if given,
+ * is set if any hash compared is a repeat, shared or not.
+ */
+__attribute__((target("avx2")))
+inline uint64_t set_intersection_count_avx2(const hash_t* a, uint64_t na, const hash_t* b, uint64_t nb, bool* repeats = NULL){
+    uint64_t count = 0;
+    uint64_t i = 0;
+    uint64_t j = 0;
+    __m256i any_repeat = _mm256_setzero_si256();
+    while (i + 4 <= na && j + 4 <= nb){
+        __m256i va = _mm256_loadu_si256((const __m256i*) (a + i));
+        __m256i vb = _mm256_loadu_si256((const __m256i*) (b + j));
+        __m256i ra = repeat_lanes_avx2(a, i, va);
+        __m256i rb = repeat_lanes_avx2(b, j, vb);
+        any_repeat = _mm256_or_si256(any_repeat, _mm256_or_si256(ra, rb));
+        __m256i m = _mm256_andnot_si256(rb, _mm256_cmpeq_epi64(va, vb));
+        vb = _mm256_permute4x64_epi64(vb, 0x39);
+        rb = _mm256_permute4x64_epi64(rb, 0x39);
+        m = _mm256_or_si256(m, _mm256_andnot_si256(rb, _mm256_cmpeq_epi64(va, vb)));
+        vb = _mm256_permute4x64_epi64(vb, 0x39);
+        rb = _mm256_permute4x64_epi64(rb, 0x39);
+        m = _mm256_or_si256(m, _mm256_andnot_si256(rb, _mm256_cmpeq_epi64(va, vb)));
+        vb = _mm256_permute4x64_epi64(vb, 0x39);
+        rb = _mm256_permute4x64_epi64(rb, 0x39);
+        m = _mm256_or_si256(m, _mm256_andnot_si256(rb, _mm256_cmpeq_epi64(va, vb)));
+        m = _mm256_andnot_si256(ra, m);
+        count += __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(m)));
+
+        hash_t amax = a[i + 3];
+        hash_t bmax = b[j + 3];
+        i += amax <= bmax ? 4 : 0;
+        j += bmax <= amax ? 4 : 0;
+    }
+    if (repeats != NULL){
+        *repeats |= !_mm256_testz_si256(any_repeat, any_repeat);
+    }
+    return count + set_merge_count(a, na, b, nb, i, j, repeats);
+}
+#endif
+
+/** Shared distinct hashes of two arrays of similar length, in blocks if this CPU has AVX2. */
+inline uint64_t block_intersection_count(const hash_t* a, uint64_t na, const hash_t* b, uint64_t nb){
+#if defined(__x86_64__) || defined(__i386__)
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2){
+        return set_intersection_count_avx2(a, na, b, nb);
+    }
+#endif
+    return set_merge_count(a, na, b, nb);
+}
+
+/** How many hashes sorted arrays a and b share, as hash_intersection_size counts them. */
+inline uint64_t hash_intersection_count(const hash_t* a, uint64_t na, const hash_t* b, uint64_t nb){
+    if (na > nb){
+        std::swap(a, b);
+        std::swap(na, nb);
+    }
+    if (na == 0){
+        return 0;
+    }
+    if (nb / na >= RKMH_GALLOP_RATIO){
+        return gallop_intersection_count(a, na, b, nb, false);
+    }
+#if defined(__x86_64__) || defined(__i386__)
+    // without repeats, every shared hash is shared once; sketches rarely have any
+    static const bool avx2 = __builtin_cpu_supports("avx2");
+    if (avx2){
+        bool repeats = false;
+        uint64_t count = set_intersection_count_avx2(a, na, b, nb, &repeats);
+        if (!repeats){
+            return count;
+        }
+    }
+#endif
+    return merge_intersection_count(a, na, b, nb);
+}
+
+/** How many distinct hashes sorted arrays a and b share. */
+inline uint64_t hash_set_intersection_count(const hash_t* a, uint64_t na, const hash_t* b, uint64_t nb){
+    if (na > nb){
+        std::swap(a, b);
+        std::swap(na, nb);
+    }
+    if (na == 0){
+        return 0;
+    }
+    if (nb / na >= RKMH_GALLOP_RATIO){
+        return gallop_intersection_count(a, na, b, nb, true);
+    }
+    return block_intersection_count(a, na, b, nb);
+}
+
+#endif
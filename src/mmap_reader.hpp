@@ -0,0 +1,183 @@
+#ifndef RKMH_MMAP_READER_HPP
+#define RKMH_MMAP_READER_HPP
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mkmh.hpp"
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * A FASTA/FASTQ record as offsets into a memory-mapped file.
+ * seq/qual point at the raw bytes and may span several lines
+ * (multi-line FASTA) and contain lowercase bases; seq_len and
+ * qual_len count only the sequence / quality characters.
+ */
+struct seq_view_t{
+    const char* name = NULL;
+    int name_len = 0;
+    const char* seq = NULL;
+    int seq_span = 0;
+    int seq_len = 0;
+    const char* qual = NULL;
+    int qual_span = 0;
+    int qual_len = 0;
+};
+
+/**
+ * Copy the bases of a view (uppercased, newlines stripped) into out,
+ * which must hold at least v.seq_len bytes.
+ */
+inline void view_to_seq(const seq_view_t& v, char* out){
+    int j = 0;
+    for (const char* p = v.seq; p < v.seq + v.seq_span; ++p){
+        if (isgraph(*p)){
+            out[j++] = toupper(*p);
+        }
+    }
+}
+
+/** Copy the quality string of a view (newlines stripped) into out, which must hold v.qual_len bytes. */
+inline void view_to_qual(const seq_view_t& v, char* out){
+    int j = 0;
+    for (const char* p = v.qual; p < v.qual + v.qual_span; ++p){
+        if (isgraph(*p)){
+            out[j++] = *p;
+        }
+    }
+}
+
+/**
+ * A read-only mapping of an uncompressed FASTA/FASTQ file that
+ * hands out records as seq_view_t. Held by shared_ptr so batches
+ * can keep it mapped until their views are no longer needed.
+ */
+class MappedFastx{
+    public:
+        MappedFastx(const char* filename){
+            int fd = open(filename, O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0){
+                cerr << "Could not open " << filename << endl;
+                exit(1);
+            }
+            size = st.st_size;
+            if (size > 0){
+                void* m = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (m == MAP_FAILED){
+                    cerr << "Could not mmap " << filename << endl;
+                    exit(1);
+                }
+                madvise(m, size, MADV_SEQUENTIAL);
+                data = (const char*) m;
+            }
+            close(fd);
+            pos = data;
+            end = data + size;
+        };
+
+        ~MappedFastx(){
+            if (data != NULL){
+                munmap((void*) data, size);
+            }
+        };
+
+        /**
+         * True for regular, non-empty files that don't start with the gzip magic,
+         * i.e. the ones that can be parsed straight out of a mapping.
+         */
+        static inline bool is_mappable(const char* filename){
+            if (strcmp(filename, "-") == 0){
+                return false;
+            }
+            struct stat st;
+            if (stat(filename, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < 2){
+                return false;
+            }
+            FILE* fp = fopen(filename, "rb");
+            if (fp == NULL){
+                return false;
+            }
+            unsigned char magic[2];
+            bool gz = fread(magic, 1, 2, fp) == 2 && magic[0] == 31 && magic[1] == 139;
+            fclose(fp);
+            return !gz;
+        };
+
+        /**
+         * Parse the next record into v. Returns false at end of file.
+         * Follows kseq: the name runs to the first whitespace, FASTA
+         * sequence runs to the next header line, and a FASTQ quality
+         * string is read until it is as long as the sequence.
+         */
+        inline bool next(seq_view_t& v){
+            while (pos < end && *pos != '>' && *pos != '@'){
+                skip_line();
+            }
+            if (pos >= end){
+                return false;
+            }
+            char header = *pos;
+            ++pos;
+            v.name = pos;
+            while (pos < end && !isspace(*pos)){
+                ++pos;
+            }
+            v.name_len = pos - v.name;
+            skip_line();
+
+            v.seq = pos;
+            v.seq_len = 0;
+            while (pos < end && *pos != '>' && *pos != '+' && !(header == '@' && *pos == '@')){
+                v.seq_len += line_chars();
+            }
+            v.seq_span = pos - v.seq;
+
+            v.qual = NULL;
+            v.qual_span = 0;
+            v.qual_len = 0;
+            if (pos < end && *pos == '+'){
+                skip_line();
+                v.qual = pos;
+                while (pos < end && v.qual_len < v.seq_len){
+                    v.qual_len += line_chars();
+                }
+                v.qual_span = pos - v.qual;
+            }
+            return true;
+        };
+
+    private:
+        const char* data = NULL;
+        uint64_t size = 0;
+        const char* pos;
+        const char* end;
+
+        inline void skip_line(){
+            const char* nl = (const char*) memchr(pos, '\n', end - pos);
+            pos = nl == NULL ? end : nl + 1;
+        };
+
+        // Advance past one line, returning how many printable characters it held.
+        inline int line_chars(){
+            const char* nl = (const char*) memchr(pos, '\n', end - pos);
+            const char* stop = nl == NULL ? end : nl;
+            int n = 0;
+            for (const char* p = pos; p < stop; ++p){
+                n += isgraph(*p) ? 1 : 0;
+            }
+            pos = nl == NULL ? end : nl + 1;
+            return n;
+        };
+};
+
+#endif
@@ -0,0 +1,757 @@
+#ifndef RKMH_PIPELINE_HPP
+#define RKMH_PIPELINE_HPP
+
+#include <string>
+#include <vector>
+#include <set>
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <omp.h>
+#include "mkmh.hpp"
+#include "HASHTCounter.hpp"
+#include "kseq_reader.hpp"
+#include "decompress.hpp"
+#include "mmap_reader.hpp"
+#include "hashing.hpp"
+#include "writer.hpp"
+#include "arena.hpp"
+#include "bottom_sketch.hpp"
+
+using namespace std;
+using namespace mkmh;
+using namespace KSR;
+
+/**
+ * A fixed-size batch of parsed FASTA/FASTQ records.
+ * Records from compressed input are copied out of the parser into the
+ * batch's arena, so the whole batch is freed at once by clear() and a
+ * reused batch stops allocating once its arena has grown to fit.
+ * Records from uncompressed files are views into a mapping (seqs[i] is NULL),
+ * which the batch keeps alive. Use hash() rather than seqs directly so both
+ * kinds are handled.
+ */
+struct seq_batch_t{
+    vector<string> keys;
+    vector<char*> seqs;
+    vector<int> lens;
+    // quality strings of copied records, if the reader keeps them (else NULL)
+    vector<char*> quals;
+    vector<seq_view_t> views;
+    // index, in the reader's file list, of the file each record came from
+    vector<int> file_ids;
+    vector<shared_ptr<MappedFastx> > maps;
+    // index of the first record of this batch across the whole input
+    uint64_t start = 0;
+    // bytes of sequence currently held by the batch
+    uint64_t bytes = 0;
+    // set by the reader (see BatchReader::use_scheme)
+    hash_scheme_t scheme;
+    // backs the copied sequences and quality strings
+    Arena arena;
+
+    inline int size() const{
+        return keys.size();
+    };
+
+    /** How many hashes hash() gives record i. */
+    inline int num_hashes(int i, vector<int>& kmer) const{
+        return num_kmer_hashes(lens[i], kmer);
+    };
+
+    /**
+     * Hash record i into h, which must hold num_hashes(i, kmer) values.
+     * Uppercasing and newline stripping of mapped records happen on the fly.
+     */
+    inline void hash_into(int i, vector<int>& kmer, hash_t* h){
+        if (seqs[i] != NULL){
+            calc_hashes_into(buffer_view(seqs[i], lens[i]), kmer, h, scheme);
+        }
+        else{
+            calc_hashes_into(views[i], kmer, h, scheme);
+        }
+    };
+
+    /**
+     * Call emit(const hash_t* h, int n) on each block of record i's hashes,
+     * in hash_into's order, without ever holding all of them.
+     */
+    template<typename EMIT>
+    inline void each_hash(int i, vector<int>& kmer, EMIT emit){
+        if (seqs[i] != NULL){
+            for_each_hash(buffer_view(seqs[i], lens[i]), kmer, scheme, emit);
+        }
+        else{
+            for_each_hash(views[i], kmer, scheme, emit);
+        }
+    };
+
+    /** Hash record i into memory from arena (usually the worker's thread_arena()). */
+    inline void hash(int i, vector<int>& kmer, hash_t*& h, int& num, Arena& arena){
+        num = num_hashes(i, kmer);
+        h = arena.alloc<hash_t>(num);
+        hash_into(i, kmer, h);
+    };
+
+    /**
+     * The (uppercased) bases of record i: the record's own copy, or,
+     * for a mapped record, a copy made in arena.
+     */
+    inline const char* get_seq(int i, Arena& arena){
+        if (seqs[i] != NULL){
+            return seqs[i];
+        }
+        char* buf = arena.alloc<char>(lens[i]);
+        view_to_seq(views[i], buf);
+        return buf;
+    };
+
+    inline void clear(){
+        arena.reset();
+        keys.clear();
+        seqs.clear();
+        lens.clear();
+        quals.clear();
+        views.clear();
+        file_ids.clear();
+        maps.clear();
+        bytes = 0;
+    };
+};
+
+/**
+ * Append record i of b to out as FASTQ if it has a quality string
+ * (the reader must keep them), FASTA otherwise.
+ */
+inline void append_record(out_buf_t& out, seq_batch_t& b, int i){
+    const seq_view_t& v = b.views[i];
+    bool fastq = b.seqs[i] != NULL ? b.quals[i] != NULL : v.qual != NULL;
+    out.append(fastq ? '@' : '>');
+    out.append(b.keys[i]);
+    out.append('\n');
+    size_t pos = out.size();
+    out.data.resize(pos + b.lens[i]);
+    if (b.seqs[i] != NULL){
+        memcpy(out.data.data() + pos, b.seqs[i], b.lens[i]);
+    }
+    else{
+        view_to_seq(v, out.data.data() + pos);
+    }
+    out.append('\n');
+    if (fastq){
+        out.append("+\n");
+        if (b.seqs[i] != NULL){
+            out.append(b.quals[i], b.lens[i]);
+        }
+        else{
+            pos = out.size();
+            out.data.resize(pos + v.qual_len);
+            view_to_qual(v, out.data.data() + pos);
+        }
+        out.append('\n');
+    }
+}
+
+/**
+ * Reads a list of FASTA/FASTQ files (BGZF, gzipped or not, "-" for STDIN) into batches
+ * of at most max_records records or max_bytes bytes of sequence,
+ * whichever comes first. A single record larger than max_bytes
+ * gets a batch of its own.
+ * Uncompressed files are memory-mapped and handed out as zero-copy
+ * views; everything else is decompressed ahead on its own thread(s)
+ * (see InflateStream) and copied out of the kseq parser.
+ */
+class BatchReader{
+    public:
+        typedef seq_batch_t batch_t;
+
+        BatchReader(vector<char*>& files, uint64_t max_bytes, int max_records = 1000, int inflate_threads = omp_get_max_threads()){
+            this->files = files;
+            this->max_bytes = max_bytes;
+            this->max_records = max_records;
+            this->inflate_threads = inflate_threads;
+        };
+
+        ~BatchReader(){
+            close_current();
+        };
+
+        /** Also keep quality strings, for callers that write reads back out. */
+        inline void keep_quals(bool keep){
+            want_quals = keep;
+        };
+
+        /** Hash this reader's batches with the given hash function and canonicalization. */
+        inline void use_scheme(const hash_scheme_t& s){
+            scheme = s;
+        };
+
+        /**
+         * Fill b with the next batch of records (copies are uppercased).
+         * If num_records is given, read exactly that many (unless the input runs out),
+         * regardless of the batch limits.
+         * Returns the number of records read; zero once all files are exhausted.
+         */
+        inline int next_batch(seq_batch_t& b, int num_records = -1){
+            b.clear();
+            b.start = num_read;
+            b.scheme = scheme;
+            while (num_records >= 0 ? b.size() < num_records :
+                    b.size() < max_records && (b.size() == 0 || b.bytes < max_bytes)){
+                if (seq == NULL && map == nullptr && !open_next()){
+                    break;
+                }
+                if (map != nullptr){
+                    seq_view_t v;
+                    if (!map->next(v)){
+                        close_current();
+                        continue;
+                    }
+                    if (b.maps.empty() || b.maps.back() != map){
+                        b.maps.push_back(map);
+                    }
+                    b.keys.emplace_back(v.name, v.name_len);
+                    b.seqs.push_back(NULL);
+                    b.quals.push_back(NULL);
+                    b.lens.push_back(v.seq_len);
+                    b.views.push_back(v);
+                    b.file_ids.push_back(file_index - 1);
+                    b.bytes += v.seq_len;
+                    continue;
+                }
+                if (inflate_kseq::kseq_read(seq) < 0){
+                    close_current();
+                    continue;
+                }
+                to_upper(seq->seq.s, seq->seq.l);
+                char* x = b.arena.alloc<char>(seq->seq.l);
+                memcpy(x, seq->seq.s, seq->seq.l);
+                b.keys.emplace_back(seq->name.s);
+                b.seqs.push_back(x);
+                char* q = NULL;
+                if (want_quals && seq->qual.l > 0){
+                    q = b.arena.alloc<char>(seq->qual.l);
+                    memcpy(q, seq->qual.s, seq->qual.l);
+                }
+                b.quals.push_back(q);
+                b.lens.push_back(seq->seq.l);
+                b.views.emplace_back();
+                b.file_ids.push_back(file_index - 1);
+                b.bytes += seq->seq.l;
+            }
+            num_read += b.size();
+            return b.size();
+        };
+
+    private:
+        vector<char*> files;
+        int file_index = 0;
+        uint64_t max_bytes;
+        int max_records;
+        int inflate_threads;
+        bool want_quals = false;
+        hash_scheme_t scheme;
+        uint64_t num_read = 0;
+        InflateStream* stream = NULL;
+        inflate_kseq::kseq_t* seq = NULL;
+        shared_ptr<MappedFastx> map;
+
+        inline bool open_next(){
+            if ((size_t) file_index >= files.size()){
+                return false;
+            }
+            char* f = files[file_index++];
+            if (MappedFastx::is_mappable(f)){
+                map = make_shared<MappedFastx>(f);
+                return true;
+            }
+            stream = new InflateStream(f, inflate_threads);
+            seq = inflate_kseq::kseq_init(stream);
+            return true;
+        };
+
+        inline void close_current(){
+            // batches still holding views keep their own reference to the mapping
+            map.reset();
+            if (seq != NULL){
+                inflate_kseq::kseq_destroy(seq);
+                seq = NULL;
+            }
+            if (stream != NULL){
+                delete stream;
+                stream = NULL;
+            }
+        };
+};
+
+/**
+ * Reads many FASTA/FASTQ files at once. A pool of reader threads each
+ * take the next unread file, parse it with a BatchReader of their own and
+ * queue up to readahead batches of it. Batches are still handed out in
+ * file order, so record indices (and in-order output) are the same as with
+ * a BatchReader over the same files; only the decoding runs concurrently.
+ * At most reader_threads * (readahead + 1) batches are held by the pool.
+ * Handed-out batch objects go back to the reader threads to be refilled,
+ * so their arenas are reused rather than reallocated.
+ *
+ * file_ids tags each record with its file's index in files.
+ */
+class MultiFileBatchReader{
+    public:
+        typedef seq_batch_t batch_t;
+
+        MultiFileBatchReader(vector<char*>& files, uint64_t max_bytes, int max_records = 1000,
+                int reader_threads = omp_get_max_threads(), int readahead = 2){
+            this->files = files;
+            this->max_bytes = max_bytes;
+            this->max_records = max_records;
+            this->readahead = readahead < 1 ? 1 : readahead;
+            int n = files.size();
+            this->reader_threads = std::max(1, std::min(reader_threads, n));
+            // whatever the reader threads leave over goes to inflating BGZF blocks
+            this->inflate_threads = std::max(1, omp_get_max_threads() / this->reader_threads);
+            queues.resize(n);
+            done.resize(n, false);
+        };
+
+        ~MultiFileBatchReader(){
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stop = true;
+            }
+            not_full.notify_all();
+            for (auto& t : readers){
+                t.join();
+            }
+            for (auto& q : queues){
+                for (auto b : q){
+                    delete b;
+                }
+            }
+            for (auto b : spare){
+                delete b;
+            }
+        };
+
+        /** As for BatchReader; set before the first call to next_batch. */
+        inline void keep_quals(bool keep){
+            want_quals = keep;
+        };
+
+        /** As for BatchReader; set before the first call to next_batch. */
+        inline void use_scheme(const hash_scheme_t& s){
+            scheme = s;
+        };
+
+        /**
+         * Fill b with the next batch of records, in file order.
+         * Returns the number of records read; zero once all files are exhausted.
+         */
+        inline int next_batch(seq_batch_t& b){
+            b.clear();
+            if (readers.empty()){
+                for (int i = 0; i < reader_threads; ++i){
+                    readers.emplace_back(&MultiFileBatchReader::run, this);
+                }
+            }
+            while (current < files.size()){
+                std::unique_lock<std::mutex> lock(mtx);
+                not_empty.wait(lock, [this]{ return !queues[current].empty() || done[current]; });
+                if (queues[current].empty()){
+                    ++current;
+                    continue;
+                }
+                seq_batch_t* next = queues[current].front();
+                queues[current].pop_front();
+                lock.unlock();
+                not_full.notify_all();
+
+                std::swap(b, *next);
+                next->clear();
+                lock.lock();
+                spare.push_back(next);
+                lock.unlock();
+                b.start = num_read;
+                num_read += b.size();
+                return b.size();
+            }
+            return 0;
+        };
+
+    private:
+        vector<char*> files;
+        uint64_t max_bytes;
+        int max_records;
+        int readahead;
+        int reader_threads;
+        int inflate_threads;
+        bool want_quals = false;
+        hash_scheme_t scheme;
+
+        vector<std::thread> readers;
+        std::atomic<int> next_file{0};
+        std::mutex mtx;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        vector<deque<seq_batch_t*> > queues;
+        vector<seq_batch_t*> spare;
+        vector<bool> done;
+        bool stop = false;
+
+        // consumer-side only
+        size_t current = 0;
+        uint64_t num_read = 0;
+
+        inline seq_batch_t* take_spare(){
+            std::lock_guard<std::mutex> lock(mtx);
+            if (spare.empty()){
+                return new seq_batch_t();
+            }
+            seq_batch_t* b = spare.back();
+            spare.pop_back();
+            return b;
+        };
+
+        inline void give_back(seq_batch_t* b){
+            b->clear();
+            std::lock_guard<std::mutex> lock(mtx);
+            spare.push_back(b);
+        };
+
+        void run(){
+            int f;
+            while ((size_t) (f = next_file++) < files.size()){
+                vector<char*> one = {files[f]};
+                BatchReader reader(one, max_bytes, max_records, inflate_threads);
+                reader.keep_quals(want_quals);
+                reader.use_scheme(scheme);
+                while (true){
+                    seq_batch_t* b = take_spare();
+                    if (reader.next_batch(*b) == 0){
+                        give_back(b);
+                        break;
+                    }
+                    std::fill(b->file_ids.begin(), b->file_ids.end(), f);
+
+                    std::unique_lock<std::mutex> lock(mtx);
+                    not_full.wait(lock, [&]{ return queues[f].size() < (size_t) readahead || stop; });
+                    if (stop){
+                        delete b;
+                        return;
+                    }
+                    queues[f].push_back(b);
+                    lock.unlock();
+                    not_empty.notify_all();
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    done[f] = true;
+                }
+                not_empty.notify_all();
+            }
+        };
+};
+
+/**
+ * Both mates of a batch of read pairs; r1[i] and r2[i] are mates.
+ */
+struct pair_batch_t{
+    seq_batch_t r1;
+    seq_batch_t r2;
+    uint64_t start = 0;
+
+    inline int size() const{
+        return r1.size();
+    };
+
+    inline void clear(){
+        r1.clear();
+        r2.clear();
+    };
+};
+
+/**
+ * Reads paired-end files in lockstep: r1_files[i] holds the first mates
+ * of r2_files[i]. Batches are sized by the R1 reader's limits and the R2
+ * reader then reads exactly as many records. Exits if the mate files
+ * don't have the same number of reads.
+ */
+class PairedBatchReader{
+    public:
+        typedef pair_batch_t batch_t;
+
+        PairedBatchReader(vector<char*>& r1_files, vector<char*>& r2_files, uint64_t max_bytes, int max_records = 1000) :
+            r1(r1_files, max_bytes / 2, max_records, std::max(1, omp_get_max_threads() / 2)),
+            r2(r2_files, max_bytes / 2, max_records, std::max(1, omp_get_max_threads() / 2)){
+            if (r1_files.size() != r2_files.size()){
+                cerr << "Paired-end input needs the same number of R1 and R2 files." << endl;
+                exit(1);
+            }
+        };
+
+        inline void keep_quals(bool keep){
+            r1.keep_quals(keep);
+            r2.keep_quals(keep);
+        };
+
+        inline void use_scheme(const hash_scheme_t& s){
+            r1.use_scheme(s);
+            r2.use_scheme(s);
+        };
+
+        inline int next_batch(pair_batch_t& b){
+            int n = r1.next_batch(b.r1);
+            int m = r2.next_batch(b.r2, n > 0 ? n : 1);
+            if (m != n){
+                cerr << "R1 and R2 inputs have different numbers of reads." << endl;
+                exit(1);
+            }
+            b.start = b.r1.start;
+            return n;
+        };
+
+    private:
+        BatchReader r1;
+        BatchReader r2;
+};
+
+/** As seq_batch_t::each_hash, over both mates of pair i (R1's hashes, then R2's). */
+template<typename EMIT>
+inline void pair_each_hash(pair_batch_t& b, int i, vector<int>& kmer, EMIT emit){
+    b.r1.each_hash(i, kmer, emit);
+    b.r2.each_hash(i, kmer, emit);
+}
+
+/**
+ * Two-stage pipeline over a BatchReader or PairedBatchReader.
+ * One thread reads batch N+1 while the rest of the team runs
+ * work(batch, begin, end) on each block of (up to) block records
+ * of batch N as OpenMP tasks. A batch is freed as a whole once its
+ * tasks finish, so at most two batches of sequence are resident at once.
+ *
+ * Each work() call may allocate from thread_arena(); whatever it
+ * allocates there is freed when it returns.
+ *
+ * grow(batch) is called serially before a batch's tasks are spawned,
+ * which makes it the place to resize any per-record output arrays.
+ * Must be called outside of a parallel region.
+ */
+template<typename READER, typename GROW, typename WORK>
+inline uint64_t pipelined_for_each_block(READER& reader, GROW grow, WORK work, int block){
+    typename READER::batch_t batches[2];
+    uint64_t total = 0;
+    block = std::max(block, 1);
+    #pragma omp parallel
+    {
+        #pragma omp single
+        {
+            int cur = 0;
+            reader.next_batch(batches[cur]);
+            while (batches[cur].size() > 0){
+                typename READER::batch_t* b = &batches[cur];
+                total += b->size();
+                grow(*b);
+                for (int i = 0; i < b->size(); i += block){
+                    int end = std::min(b->size(), i + block);
+                    #pragma omp task firstprivate(b, i, end)
+                    {
+                        arena_scope_t scope(thread_arena());
+                        work(*b, i, end);
+                    }
+                }
+                reader.next_batch(batches[1 - cur]);
+                #pragma omp taskwait
+                b->clear();
+                cur = 1 - cur;
+            }
+        }
+    }
+    return total;
+}
+
+/** pipelined_for_each_block one record at a time: work(batch, i). */
+template<typename READER, typename GROW, typename WORK>
+inline uint64_t pipelined_for_each(READER& reader, GROW grow, WORK work){
+    return pipelined_for_each_block(reader, grow,
+            [&](typename READER::batch_t& b, int begin, int end){
+                for (int i = begin; i < end; ++i){
+                    work(b, i);
+                }
+            }, 1);
+}
+
+// a sketch location (see locate_sketch) that was never found
+#define RKMH_NO_LOC (~((uint64_t) 0))
+
+/**
+ * Find where each hash of record i's sketch (mins, sorted ascending) came from:
+ * locs[j] = (position << 1) | strand for mins[j], where position is the 0-based
+ * start of the kmer and strand is 1 if its reverse complement gave the hash.
+ * The record is hashed again; all but the few kmers at or below the sketch's
+ * largest hash are rejected by one comparison. A hash the sketch holds more
+ * than once gets successive occurrences.
+ */
+inline void locate_sketch(seq_batch_t& b, int i, vector<int>& kmer,
+        const hash_t* mins, int n, uint64_t* locs, Arena& arena){
+    std::fill(locs, locs + n, RKMH_NO_LOC);
+    if (n == 0){
+        return;
+    }
+    const char* seq = b.get_seq(i, arena);
+    hash_t top = mins[n - 1];
+    // positions are 64-bit, as stored in locs, so long references don't wrap
+    uint64_t* pos = arena.alloc<uint64_t>(kmer.size());
+    std::fill(pos, pos + kmer.size(), 0);
+    for_each_hash_multi(buffer_view(seq, b.lens[i]), kmer, b.scheme, [&](int ki, const hash_t* h, int m){
+            for (int j = 0; j < m; ++j){
+                uint64_t p = pos[ki]++;
+                if (h[j] == 0 || h[j] > top){
+                    continue;
+                }
+                for (const hash_t* x = std::lower_bound(mins, mins + n, h[j]); x < mins + n && *x == h[j]; ++x){
+                    uint64_t& l = locs[x - mins];
+                    if (l == RKMH_NO_LOC){
+                        l = (p << 1) | (kmer_on_reverse(seq + p, kmer[ki], b.scheme) ? 1 : 0);
+                        break;
+                    }
+                }
+            }
+            });
+}
+
+/**
+ * Approximate placement of a read on a reference from their sketches alone:
+ * the median position, among ref_locs (see locate_sketch), of the hashes
+ * the read's sketch shares with the reference's. -1 if they share none.
+ */
+inline int64_t sketch_placement(const hash_t* read_mins, int read_len,
+        const hash_t* ref_mins, int ref_len, const uint64_t* ref_locs, Arena& arena){
+    uint64_t* pos = arena.alloc<uint64_t>(std::max(1, std::min(read_len, ref_len)));
+    int n = 0;
+    int i = 0;
+    int j = 0;
+    while (i < read_len && j < ref_len){
+        if (read_mins[i] < ref_mins[j]){
+            ++i;
+        }
+        else if (ref_mins[j] < read_mins[i]){
+            ++j;
+        }
+        else{
+            if (ref_locs[j] != RKMH_NO_LOC){
+                pos[n++] = ref_locs[j] >> 1;
+            }
+            ++i;
+            ++j;
+        }
+    }
+    if (n == 0){
+        return -1;
+    }
+    std::nth_element(pos, pos + n / 2, pos + n);
+    return pos[n / 2];
+}
+
+/**
+ * Sketch every reference in files without holding them all in memory.
+ * Each reference is sketched as its kmers are hashed (see BottomSketcher),
+ * so only its sequence is ever held, never its hashes. mem_ceiling (bytes)
+ * bounds the sequence in flight: one batch is being sketched while the
+ * reader pool holds up to three more per reader thread (see MultiFileBatchReader).
+ *
+ * If ref_counter is non-NULL, a first pass counts each hash's reference occurrences
+ * (once per reference when per_sample is set, otherwise every occurrence)
+ * and sketches drop hashes seen more than max_samples times.
+ * scheme must match that of any precomputed sketches they are compared with.
+ * A nonzero max_hash makes FracMinHash sketches (see BottomSketcher) instead
+ * of bottom sketch_size ones.
+ * If locs is given, locs[i] is set to where each hash of mins[i] came from (see locate_sketch).
+ * With SKETCH_ONE_PERM, mins[i] are instead one-permutation sketches of sketch_size slots.
+ */
+inline void sketch_reference_files(vector<char*>& files,
+        vector<int>& kmer,
+        int sketch_size,
+        uint64_t mem_ceiling,
+        vector<string>& keys,
+        vector<hash_t*>& mins,
+        vector<int>& min_lens,
+        HASHTCounter* ref_counter = NULL,
+        int max_samples = 100000,
+        bool per_sample = false,
+        const hash_scheme_t& scheme = hash_scheme_t(),
+        hash_t max_hash = 0,
+        vector<const uint64_t*>* locs = NULL,
+        sketch_scheme_t sketch_scheme = SKETCH_BOTTOM){
+
+    int readers = std::max(1, std::min(omp_get_max_threads(), (int) files.size()));
+    uint64_t per_base = 1 + 3 * readers;
+    uint64_t batch_bytes = mem_ceiling / per_base;
+
+    if (ref_counter != NULL){
+        MultiFileBatchReader counter_reader(files, batch_bytes, 1000, readers);
+        counter_reader.use_scheme(scheme);
+        pipelined_for_each(counter_reader,
+                [&](seq_batch_t&){},
+                [&](seq_batch_t& b, int i){
+                    if (per_sample){
+                        set<hash_t> sample_set;
+                        b.each_hash(i, kmer, [&](const hash_t* h, int n){
+                                sample_set.insert(h, h + n);
+                                });
+                        for (auto x : sample_set){
+                            ref_counter->increment(x);
+                        }
+                    }
+                    else{
+                        b.each_hash(i, kmer, [&](const hash_t* h, int n){
+                                for (int j = 0; j < n; ++j){
+                                    ref_counter->increment(h[j]);
+                                }
+                                });
+                    }
+                });
+    }
+
+    MultiFileBatchReader reader(files, batch_bytes, 1000, readers);
+    reader.use_scheme(scheme);
+    pipelined_for_each(reader,
+            [&](seq_batch_t& b){
+                keys.insert(keys.end(), b.keys.begin(), b.keys.end());
+                mins.resize(keys.size());
+                min_lens.resize(keys.size());
+                if (locs != NULL){
+                    locs->resize(keys.size());
+                }
+            },
+            [&](seq_batch_t& b, int i){
+                uint64_t id = b.start + i;
+                BottomSketcher sk(sketch_size, thread_arena(), max_hash, sketch_scheme);
+                b.each_hash(i, kmer, [&](const hash_t* h, int n){
+                        for (int j = 0; j < n; ++j){
+                            // the count is only looked up for hashes small enough to matter
+                            if (sk.wants(h[j]) && (ref_counter == NULL || ref_counter->get(h[j]) <= max_samples)){
+                                sk.push(h[j]);
+                            }
+                        }
+                        });
+                // the sketcher's buffer is scratch; the sketch itself outlives the batch
+                hash_t* sketch;
+                sk.finish(sketch, min_lens[id]);
+                mins[id] = new hash_t[std::max(sketch_size, min_lens[id])];
+                memcpy(mins[id], sketch, min_lens[id] * sizeof(hash_t));
+                if (locs != NULL){
+                    uint64_t* l = new uint64_t[std::max(1, min_lens[id])];
+                    locate_sketch(b, i, kmer, mins[id], min_lens[id], l, thread_arena());
+                    (*locs)[id] = l;
+                }
+            });
+}
+
+#endif
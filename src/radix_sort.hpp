@@ -0,0 +1,239 @@
+#ifndef RKMH_RADIX_SORT_HPP
+#define RKMH_RADIX_SORT_HPP
+
+#include <algorithm>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <omp.h>
+#include "mkmh.hpp"
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * Radix sorts for arrays of hashes. Hashes are uniformly spread 64-bit
+ * keys, the best case for a radix sort: every pass buckets the array on
+ * one byte, with no comparisons to mispredict.
+ *
+ * radix_sort is an LSD sort through a scratch array as large as the input,
+ * or, given no scratch, an in-place MSD (American flag) sort for arrays too
+ * large to double. parallel_radix_sort puts every thread on one large array
+ * (a reference genome); radix_sort_each sorts many arrays at once.
+ * Arrays shorter than RKMH_RADIX_MIN go to std::sort, which is faster on them.
+ */
+#define RKMH_RADIX_MIN 256
+// below this, one thread sorts an array faster than a team can
+#define RKMH_PARALLEL_RADIX_MIN (1 << 17)
+
+inline int radix_byte(hash_t x, int shift){
+    return (x >> shift) & 255;
+}
+
+/**
+ * Move every hash of h into its bucket by the byte at shift, given how many
+ * hashes each bucket gets. starts (257 entries) is set to the buckets' bounds.
+ * Each hash is swapped straight into the next free slot of its bucket, so
+ * nothing but h is touched.
+ */
+inline void radix_permute(hash_t* h, const size_t* counts, int shift, size_t* starts){
+    size_t next[256];
+    starts[0] = 0;
+    for (int b = 0; b < 256; ++b){
+        starts[b + 1] = starts[b] + counts[b];
+        next[b] = starts[b];
+    }
+    for (int b = 0; b < 256; ++b){
+        while (next[b] < starts[b + 1]){
+            hash_t x = h[next[b]];
+            int xb = radix_byte(x, shift);
+            while (xb != b){
+                std::swap(x, h[next[xb]++]);
+                xb = radix_byte(x, shift);
+            }
+            h[next[b]++] = x;
+        }
+    }
+}
+
+/** In-place MSD sort of h, whose hashes all agree above the byte at shift. */
+inline void radix_sort_in_place(hash_t* h, size_t n, int shift = 56){
+    if (n < RKMH_RADIX_MIN){
+        std::sort(h, h + n);
+        return;
+    }
+    size_t counts[256] = {0};
+    for (size_t i = 0; i < n; ++i){
+        ++counts[radix_byte(h[i], shift)];
+    }
+    size_t starts[257];
+    radix_permute(h, counts, shift, starts);
+    if (shift == 0){
+        return;
+    }
+    for (int b = 0; b < 256; ++b){
+        radix_sort_in_place(h + starts[b], counts[b], shift - 8);
+    }
+}
+
+/**
+ * Sort n hashes ascending. With tmp (n hashes of scratch), an LSD sort:
+ * one read of h builds every byte's histogram, then one stable scatter per
+ * byte, skipping bytes all the hashes share. Without it, radix_sort_in_place.
+ */
+inline void radix_sort(hash_t* h, size_t n, hash_t* tmp = NULL){
+    if (n < RKMH_RADIX_MIN){
+        std::sort(h, h + n);
+        return;
+    }
+    if (tmp == NULL){
+        radix_sort_in_place(h, n);
+        return;
+    }
+    vector<size_t> counts(8 * 256, 0);
+    for (size_t i = 0; i < n; ++i){
+        hash_t x = h[i];
+        for (int d = 0; d < 8; ++d){
+            ++counts[d * 256 + radix_byte(x, 8 * d)];
+        }
+    }
+    hash_t* src = h;
+    hash_t* dst = tmp;
+    for (int d = 0; d < 8; ++d){
+        size_t* c = &counts[d * 256];
+        int shift = 8 * d;
+        if (c[radix_byte(src[0], shift)] == n){
+            continue;
+        }
+        size_t sum = 0;
+        for (int b = 0; b < 256; ++b){
+            size_t x = c[b];
+            c[b] = sum;
+            sum += x;
+        }
+        for (size_t i = 0; i < n; ++i){
+            dst[c[radix_byte(src[i], shift)]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+    if (src != h){
+        memcpy(h, src, n * sizeof(hash_t));
+    }
+}
+
+/**
+ * Sort one large array with up to threads OpenMP threads. The default is a
+ * parallel LSD sort: each thread histograms and then scatters its own slice,
+ * into offsets laid out so the result is the same as radix_sort's. It needs
+ * n hashes of scratch; with in_place, the top byte is instead bucketed in
+ * place and the 256 buckets are sorted by radix_sort_in_place in parallel.
+ * Should be called outside of a parallel region.
+ */
+inline void parallel_radix_sort(hash_t* h, size_t n, bool in_place = false, int threads = omp_get_max_threads()){
+    if (threads <= 1 || n < RKMH_PARALLEL_RADIX_MIN){
+        vector<hash_t> tmp(in_place ? 0 : n);
+        radix_sort(h, n, in_place ? NULL : tmp.data());
+        return;
+    }
+    vector<size_t> counts(threads * 256);
+
+    if (in_place){
+        #pragma omp parallel num_threads(threads)
+        {
+            int nt = omp_get_num_threads();
+            int t = omp_get_thread_num();
+            size_t* c = &counts[t * 256];
+            std::fill(c, c + 256, 0);
+            for (size_t i = n * t / nt; i < n * (t + 1) / nt; ++i){
+                ++c[radix_byte(h[i], 56)];
+            }
+        }
+        for (int t = 1; t < threads; ++t){
+            for (int b = 0; b < 256; ++b){
+                counts[b] += counts[t * 256 + b];
+            }
+        }
+        size_t starts[257];
+        radix_permute(h, counts.data(), 56, starts);
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+        for (int b = 0; b < 256; ++b){
+            radix_sort_in_place(h + starts[b], starts[b + 1] - starts[b], 48);
+        }
+        return;
+    }
+
+    vector<hash_t> tmp(n);
+    hash_t* src = h;
+    hash_t* dst = tmp.data();
+    for (int shift = 0; shift < 64; shift += 8){
+        bool skip = false;
+        #pragma omp parallel num_threads(threads)
+        {
+            int nt = omp_get_num_threads();
+            int t = omp_get_thread_num();
+            size_t lo = n * t / nt;
+            size_t hi = n * (t + 1) / nt;
+            size_t* c = &counts[t * 256];
+            std::fill(c, c + 256, 0);
+            for (size_t i = lo; i < hi; ++i){
+                ++c[radix_byte(src[i], shift)];
+            }
+            #pragma omp barrier
+            #pragma omp single
+            {
+                // bucket-major, then slice order, which keeps the scatter stable
+                size_t sum = 0;
+                for (int b = 0; b < 256; ++b){
+                    size_t start = sum;
+                    for (int s = 0; s < nt; ++s){
+                        size_t x = counts[s * 256 + b];
+                        counts[s * 256 + b] = sum;
+                        sum += x;
+                    }
+                    // every hash shares this byte, so the pass would change nothing
+                    skip |= sum - start == n;
+                }
+            }
+            if (!skip){
+                for (size_t i = lo; i < hi; ++i){
+                    dst[c[radix_byte(src[i], shift)]++] = src[i];
+                }
+            }
+        }
+        if (!skip){
+            std::swap(src, dst);
+        }
+    }
+    if (src != h){
+        memcpy(h, src, n * sizeof(hash_t));
+    }
+}
+
+/**
+ * Sort num arrays (e.g. the hashes of each read, or of each reference).
+ * With at least as many arrays as threads, each thread sorts whole arrays;
+ * otherwise the arrays take turns getting every thread (parallel_radix_sort).
+ * Should be called outside of a parallel region.
+ */
+inline void radix_sort_each(hash_t** arrays, const int* lens, int num, bool in_place = false){
+    int threads = omp_get_max_threads();
+    if (num < threads){
+        for (int i = 0; i < num; ++i){
+            parallel_radix_sort(arrays[i], lens[i], in_place, threads);
+        }
+        return;
+    }
+    #pragma omp parallel
+    {
+        vector<hash_t> tmp;
+        #pragma omp for schedule(dynamic, 1)
+        for (int i = 0; i < num; ++i){
+            if (!in_place && tmp.size() < (size_t) lens[i]){
+                tmp.resize(lens[i]);
+            }
+            radix_sort(arrays[i], lens[i], in_place ? NULL : tmp.data());
+        }
+    }
+}
+
+#endif
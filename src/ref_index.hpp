@@ -0,0 +1,364 @@
+#ifndef RKMH_REF_INDEX_HPP
+#define RKMH_REF_INDEX_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <sys/stat.h>
+#include "mkmh.hpp"
+#include "radix_sort.hpp"
+#include "sketch_matrix.hpp"
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * Inverted index from hashes to the reference sketches holding them.
+ * Classifying a read against every reference in turn is a sorted
+ * intersection per reference, O(refs * sketch); with the index it is one
+ * lookup per read hash plus a counter bump per reference sharing it,
+ * whatever the size of the panel.
+ *
+ * Each distinct hash has a slot in an open-addressing table (linear
+ * probing, at most half full) holding the hash and the range of its
+ * postings. Postings are (reference, count) pairs, back to back in one
+ * array, with references ascending. count is how many times the hash is
+ * in that reference's sketch (1 with distinct), so the counts come out the
+ * same as hash_intersection_size's (or hash_set_intersection_size's).
+ *
+ * Built once, then only read: any number of threads can count() at once.
+ * save() / load() write and read it as (native byte order):
+ *
+ *  ref_index_header_t
+ *  ref_index_slot_t    table[table_size]
+ *  ref_posting_t       postings[num_postings]
+ *
+ * `hash -b --index` saves one next to the sketch database it writes, with
+ * the suffix RKMH_REF_INDEX_SUFFIX, so `stream` and `filter` needn't
+ * rebuild it. The header records the kmer sizes, hash function and sketch size the
+ * sketches were made with, and a digest of the sketches themselves; load()
+ * takes an index only if all of them match the panel it is meant for.
+ */
+#define RKMH_REF_INDEX_MAGIC "RKMHRIDX"
+#define RKMH_REF_INDEX_VERSION 2
+#define RKMH_REF_INDEX_SUFFIX ".idx"
+
+struct ref_index_slot_t{
+    hash_t key;
+    uint32_t start;
+    // 0 for an empty slot
+    uint32_t len;
+};
+
+struct ref_posting_t{
+    uint32_t ref;
+    uint32_t count;
+};
+
+struct ref_index_header_t{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_refs;
+    uint64_t table_size;
+    uint64_t num_postings;
+    uint32_t hash_fn;
+    uint32_t sketch_size;
+    // 1 if repeats within a sketch were counted once
+    uint32_t distinct;
+    uint32_t num_kmers;
+    uint32_t kmers[RKMH_SKETCH_DB_MAX_KMERS];
+    // RefIndex::digest of the indexed sketches
+    uint64_t panel_digest;
+};
+static_assert(sizeof(ref_index_header_t) == 88, "reference index header must stay 88 bytes");
+
+class RefIndex{
+    public:
+        RefIndex(){
+            num_refs = 0;
+            mask = 0;
+            distinct = false;
+            panel_digest = 0;
+        };
+
+        /**
+         * Index num sketches, each sorted ascending (as minhashes returns them).
+         * With distinct, repeats of a hash within a sketch count once.
+         */
+        RefIndex(const hash_t* const* sketches, const int* lens, int num, bool distinct = false){
+            num_refs = num;
+            this->distinct = distinct;
+            panel_digest = digest(sketches, lens, num);
+
+            // the distinct hashes, to size the table
+            uint64_t total = 0;
+            for (int i = 0; i < num; ++i){
+                total += lens[i];
+            }
+            vector<hash_t> all(total);
+            uint64_t off = 0;
+            for (int i = 0; i < num; ++i){
+                memcpy(all.data() + off, sketches[i], lens[i] * sizeof(hash_t));
+                off += lens[i];
+            }
+            parallel_radix_sort(all.data(), total);
+            uint64_t distinct_hashes = std::unique(all.begin(), all.end()) - all.begin();
+            vector<hash_t>().swap(all);
+
+            uint64_t size = 16;
+            while (size < 2 * distinct_hashes){
+                size <<= 1;
+            }
+            table.assign(size, ref_index_slot_t());
+            mask = size - 1;
+
+            // count each hash's postings, then give each its range, ending where the next starts
+            for (int i = 0; i < num; ++i){
+                for (int j = 0; j < lens[i]; j = next_run(sketches[i], lens[i], j)){
+                    ref_index_slot_t& s = insert(sketches[i][j]);
+                    ++s.len;
+                }
+            }
+            uint64_t sum = 0;
+            for (auto& s : table){
+                sum += s.len;
+                s.start = sum;
+            }
+            postings.resize(sum);
+
+            // filled back to front, so each range's references end up ascending
+            for (int i = num - 1; i >= 0; --i){
+                for (int j = 0; j < lens[i]; ){
+                    int next = next_run(sketches[i], lens[i], j);
+                    ref_index_slot_t& s = insert(sketches[i][j]);
+                    ref_posting_t& p = postings[--s.start];
+                    p.ref = i;
+                    p.count = distinct ? 1 : next - j;
+                    j = next;
+                }
+            }
+        };
+
+        /** Index the rows of a sketch matrix. */
+        RefIndex(const SketchMatrix& sketches, bool distinct = false) :
+            RefIndex(sketches.rows().data(), sketches.lens(), sketches.size(), distinct){
+        };
+
+        inline int refs() const{
+            return num_refs;
+        };
+
+        /** Distinct hashes indexed. */
+        inline uint64_t size() const{
+            uint64_t n = 0;
+            for (auto& s : table){
+                n += s.len != 0;
+            }
+            return n;
+        };
+
+        inline uint64_t bytes() const{
+            return table.size() * sizeof(ref_index_slot_t) + postings.size() * sizeof(ref_posting_t);
+        };
+
+        /**
+         * The slot of x, or NULL if no reference has it. Its postings
+         * are posting_data()[start] to posting_data()[start + len - 1].
+         */
+        inline const ref_index_slot_t* find(hash_t x) const{
+            if (table.empty()){
+                return NULL;
+            }
+            for (uint64_t i = slot_of(x); table[i].len != 0; i = (i + 1) & mask){
+                if (table[i].key == x){
+                    return &table[i];
+                }
+            }
+            return NULL;
+        };
+
+        inline const ref_posting_t* posting_data() const{
+            return postings.data();
+        };
+
+        /**
+         * Set shared[r] (refs() of them) to how many of hashes, sorted
+         * ascending, reference r's sketch shares, counting a hash repeated
+         * in both as often as the fewer repeats.
+         */
+        inline void count(const hash_t* hashes, int num, int* shared) const{
+            std::fill(shared, shared + num_refs, 0);
+            for (int i = 0; i < num; ){
+                int next = next_run(hashes, num, i);
+                const ref_index_slot_t* s = find(hashes[i]);
+                if (s != NULL){
+                    uint32_t repeats = next - i;
+                    const ref_posting_t* p = postings.data() + s->start;
+                    for (uint32_t k = 0; k < s->len; ++k){
+                        shared[p[k].ref] += std::min(repeats, p[k].count);
+                    }
+                }
+                i = next;
+            }
+        };
+
+        /**
+         * A digest of num sketches, lengths and hashes both, to tell whether
+         * a saved index was built from the same panel.
+         */
+        static inline uint64_t digest(const hash_t* const* sketches, const int* lens, int num){
+            uint64_t d = mix(0, num);
+            for (int i = 0; i < num; ++i){
+                d = mix(d, lens[i]);
+                for (int j = 0; j < lens[i]; ++j){
+                    d = mix(d, sketches[i][j]);
+                }
+            }
+            return d;
+        };
+
+        /**
+         * Write the index to filename, recording the kmer sizes, hash function
+         * and sketch size its sketches were made with. Returns false if it
+         * can't be written.
+         */
+        inline bool save(const string& filename, const vector<int>& kmer, hash_fn_t fn, int sketch_size) const{
+            if (kmer.size() > RKMH_SKETCH_DB_MAX_KMERS){
+                return false;
+            }
+            FILE* fp = fopen(filename.c_str(), "wb");
+            if (fp == NULL){
+                return false;
+            }
+            ref_index_header_t h;
+            memset(&h, 0, sizeof(h));
+            memcpy(h.magic, RKMH_REF_INDEX_MAGIC, 8);
+            h.version = RKMH_REF_INDEX_VERSION;
+            h.num_refs = num_refs;
+            h.table_size = table.size();
+            h.num_postings = postings.size();
+            h.hash_fn = fn;
+            h.sketch_size = sketch_size;
+            h.distinct = distinct;
+            h.num_kmers = kmer.size();
+            for (size_t i = 0; i < kmer.size(); ++i){
+                h.kmers[i] = kmer[i];
+            }
+            h.panel_digest = panel_digest;
+            fwrite(&h, sizeof(h), 1, fp);
+            fwrite(table.data(), sizeof(ref_index_slot_t), table.size(), fp);
+            fwrite(postings.data(), sizeof(ref_posting_t), postings.size(), fp);
+            bool ok = !ferror(fp);
+            return (fclose(fp) == 0) && ok;
+        };
+
+        /**
+         * Replace this index with one written by save(), if it indexes exactly
+         * these num sketches, made with kmer, fn and sketch_size (and counted
+         * the same way). Every slot and posting is checked to lie within the
+         * index, so a corrupt file is refused rather than read out of bounds.
+         * Returns false, leaving the index empty, if filename is missing,
+         * corrupt or for another panel.
+         */
+        inline bool load(const string& filename, const hash_t* const* sketches, const int* lens, int num,
+                const vector<int>& kmer, hash_fn_t fn, int sketch_size, bool distinct = false){
+            *this = RefIndex();
+            FILE* fp = fopen(filename.c_str(), "rb");
+            if (fp == NULL){
+                return false;
+            }
+            struct stat st;
+            ref_index_header_t h;
+            bool ok = fstat(fileno(fp), &st) == 0 &&
+                fread(&h, sizeof(h), 1, fp) == 1 &&
+                memcmp(h.magic, RKMH_REF_INDEX_MAGIC, 8) == 0 &&
+                h.version == RKMH_REF_INDEX_VERSION &&
+                h.table_size != 0 && (h.table_size & (h.table_size - 1)) == 0 &&
+                // sizes bounded first so the total can't overflow
+                h.table_size <= (uint64_t) st.st_size && h.num_postings <= (uint64_t) st.st_size &&
+                sizeof(h) + h.table_size * sizeof(ref_index_slot_t) +
+                        h.num_postings * sizeof(ref_posting_t) == (uint64_t) st.st_size &&
+                h.num_refs == (uint32_t) num && h.hash_fn == (uint32_t) fn &&
+                h.sketch_size == (uint32_t) sketch_size && h.distinct == (uint32_t) distinct &&
+                h.num_kmers == kmer.size() && h.num_kmers <= RKMH_SKETCH_DB_MAX_KMERS;
+            for (uint32_t i = 0; ok && i < h.num_kmers; ++i){
+                ok = h.kmers[i] == (uint32_t) kmer[i];
+            }
+            ok = ok && h.panel_digest == digest(sketches, lens, num);
+            if (ok){
+                table.resize(h.table_size);
+                postings.resize(h.num_postings);
+                ok = fread(table.data(), sizeof(ref_index_slot_t), table.size(), fp) == table.size() &&
+                    fread(postings.data(), sizeof(ref_posting_t), postings.size(), fp) == postings.size();
+            }
+            fclose(fp);
+
+            // find() stops at an empty slot, so there must be one
+            bool any_empty = false;
+            for (uint64_t i = 0; ok && i < table.size(); ++i){
+                const ref_index_slot_t& s = table[i];
+                any_empty |= s.len == 0;
+                ok = s.len == 0 || (uint64_t) s.start + s.len <= postings.size();
+            }
+            for (uint64_t i = 0; ok && i < postings.size(); ++i){
+                ok = postings[i].ref < h.num_refs && postings[i].count > 0;
+            }
+            if (!ok || !any_empty){
+                *this = RefIndex();
+                return false;
+            }
+            num_refs = h.num_refs;
+            mask = h.table_size - 1;
+            this->distinct = distinct;
+            panel_digest = h.panel_digest;
+            return true;
+        };
+
+        /** load() for the rows of a sketch matrix. */
+        inline bool load(const string& filename, const SketchMatrix& sketches,
+                const vector<int>& kmer, hash_fn_t fn, int sketch_size, bool distinct = false){
+            return load(filename, sketches.rows().data(), sketches.lens(), sketches.size(),
+                    kmer, fn, sketch_size, distinct);
+        };
+
+    private:
+        int num_refs;
+        uint64_t mask;
+        bool distinct;
+        uint64_t panel_digest;
+        vector<ref_index_slot_t> table;
+        vector<ref_posting_t> postings;
+
+        // hashes are spread evenly, but bottom sketches only use their low end
+        inline uint64_t slot_of(hash_t x) const{
+            return (x * 0x9e3779b97f4a7c15ULL >> 32) & mask;
+        };
+
+        inline ref_index_slot_t& insert(hash_t x){
+            uint64_t i = slot_of(x);
+            while (table[i].len != 0 && table[i].key != x){
+                i = (i + 1) & mask;
+            }
+            table[i].key = x;
+            return table[i];
+        };
+
+        static inline uint64_t mix(uint64_t d, uint64_t x){
+            d = (d ^ x) * 0x9e3779b97f4a7c15ULL;
+            return d ^ (d >> 29);
+        };
+
+        // the index after the run of copies of h[i]
+        static inline int next_run(const hash_t* h, int n, int i){
+            int j = i + 1;
+            while (j < n && h[j] == h[i]){
+                ++j;
+            }
+            return j;
+        };
+};
+
+#endif
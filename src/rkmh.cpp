@@ -12,6 +12,7 @@
 #include <zlib.h>
 #include <omp.h>
 #include <getopt.h>
+#include <unistd.h>
 #include <map>
 #include <unordered_map>
 #include "mkmh.hpp"
@@ -20,6 +21,16 @@
 #include "json.hpp"
 #include "HASHTCounter.hpp"
 #include "kseq_reader.hpp"
+#include "pipeline.hpp"
+#include "hashing.hpp"
+#include "writer.hpp"
+#include "sketch_db.hpp"
+#include "radix_sort.hpp"
+#include "bbit_sketch.hpp"
+#include "ref_index.hpp"
+#include "sketch_matrix.hpp"
+#include "top_two.hpp"
+#include "cache_info.hpp"
 
 // for convenience
 using json = nlohmann::json;
@@ -134,6 +145,7 @@ void help_classify(char** argv){
         << "--min-matches/-N <MINMATCHES>" << endl
         << "--min-diff/-D    <MINDIFFERENCE>" << endl
         << "--min-informative/-I <MAXSAMPLES> only use kmers present in fewer than MAXSAMPLES" << endl
+        << "--hash/-H <murmur|rolling> (hpv16) kmer hash function (default murmur, see hash)." << endl
         << endl;
 }
 
@@ -145,6 +157,7 @@ void help_call(char** argv){
         << "--threads/-t <THREADS>    the number of OpenMP threads to utilize." << endl
         << "--window-len/-w <WINLEN>  the width of the sliding window to use for calculating average depth." << endl
         << "--depth/-d                output tab-separated values for position, avg depth, instantaneous depth, and rescued depth." << endl
+        << "--hash/-H <murmur|rolling> kmer hash function (default murmur, see hash)." << endl
         << endl;
 }
 
@@ -158,7 +171,15 @@ void help_hash(char** argv){
         << "--min-kmer-occurrence <M>    Minimum kmer occurrence. Failing kmers are removed from sketch." << endl
         << "--min-informative/-I  <I>    Maximum number of samples a kmer can occur in before it is removed" << endl
         << "--threads/-t <THREADS>       number of OpenMP threads to utilize." << endl
-        << "--wabbitize /-w              output Vowpal Wabbit compatible vectors" << endl;
+        << "--wabbitize /-w              output Vowpal Wabbit compatible vectors" << endl
+        << "--binary/-b <FILE>           write the sketch of each sequence to a binary sketch database (\"-\" for STDOUT)." << endl
+        << "--json/-j <FILE>             write the sketch of each sequence as Mash-style JSON (\"-\" for STDOUT)." << endl
+        << "--positions/-P               also store where each hash of a -b sketch came from (position and strand)." << endl
+        << "--index                      also write the reference index of a -b database to <FILE>.idx, for stream" << endl
+        << "                             and filter to load with -R rather than build (for reference panels)." << endl
+        << "--hash/-H <murmur|rolling>   kmer hash function. murmur (default) is MurmurHash3, as in Mash and sourmash;" << endl
+        << "                             rolling hashes 2-bit packed kmers (k <= 32) and is faster, but is rkmh-only." << endl
+        << "--in-order/-O                write results in input order (default: as they complete)." << endl;
 }
 
 void help_stream(char** argv){
@@ -178,8 +199,22 @@ void help_stream(char** argv){
         << "--min-informative/-I <MAXSAMPLES> only use kmers present in fewer than MAXSAMPLES" << endl
         << "--kmer-depth-map / -p <mapfile> the kmer depth map to use for min_kmer_occurence" << endl
         << "--ref-sample-map / -q <mapfile> the sample depth map for reference sample filtering." << endl
-        << "--pre-fasta / -F  a file containing sketches in JSON format for reads." << endl
-        << "--pre-reference / -R a file containing pre-hashed reference genomes in JSON format." << endl
+        << "--pre-fasta / -F  precomputed read sketches (as for -R), classified as they are." << endl
+        << "--pre-reference / -R precomputed reference sketches, used in place of hashing: a sketch database" << endl
+        << "                     from `rkmh hash -b`, or JSON from `rkmh hash -j`, `mash info -d` or sourmash." << endl
+        << "--ref-mem / -B <MB> memory ceiling for reference sequence held while sketching (default 1024)." << endl
+        << "--in-order / -O     write results in input order (default: as they complete)." << endl
+        << "--r1 / -1 <R1> --r2 / -2 <R2>  paired-end reads; each pair is sketched and classified as one. May be repeated." << endl
+        << "--tag-files / -T    add a column with the input file each read came from." << endl
+        << "--hash / -H <murmur|rolling>  kmer hash function (default murmur, see hash)." << endl
+        << "--scaled / -x <SCALE> FracMinHash sketches: keep every hash below 2^64 / SCALE rather than the" << endl
+        << "                     bottom -s, and report the read's sketch size in place of -s (shared / it = containment)." << endl
+        << "--positions / -P    add a column with the read's approximate position on its best reference (-1 if" << endl
+        << "                     unplaced, * if the reference has no positions, e.g. -R without `rkmh hash -P`)." << endl
+        << "--bits <B>          compare b-bit (1, 2 or 4) one-permutation sketches of -s slots, packed so the whole" << endl
+        << "                     reference panel fits in cache; the shared column is then an estimate." << endl
+        << "--sketch-scheme / -e <bottom|oph>  bottom-s sketches (default), or densified one-permutation sketches of" << endl
+        << "                     -s slots, built in one pass and compared slot by slot." << endl
         << endl;
 
 }
@@ -201,8 +236,16 @@ void help_filter(char** argv){
         << "--min-informative/-I <MAXSAMPLES> only use kmers present in fewer than MAXSAMPLES" << endl
         << "--kmer-depth-map / -p <mapfile> the kmer depth map to use for min_kmer_occurence" << endl
         << "--ref-sample-map / -q <mapfile> the sample depth map for reference sample filtering." << endl
-        << "--pre-fasta / -F  a file containing sketches in JSON format for reads." << endl
-        << "--pre-reference / -R a file containing pre-hashed reference genomes in JSON format." << endl
+        << "--pre-fasta / -F  precomputed read sketches (as for -R), classified as they are." << endl
+        << "--pre-reference / -R precomputed reference sketches, used in place of hashing: a sketch database" << endl
+        << "                     from `rkmh hash -b`, or JSON from `rkmh hash -j`, `mash info -d` or sourmash." << endl
+        << "--ref-mem / -B <MB> memory ceiling for reference sequence held while sketching (default 1024)." << endl
+        << "--in-order / -O     write results in input order (default: as they complete)." << endl
+        << "--r1 / -1 <R1> --r2 / -2 <R2>  paired-end reads; each pair is sketched and classified as one. May be repeated." << endl
+        << "--hash / -H <murmur|rolling>  kmer hash function (default murmur, see hash)." << endl
+        << "--scaled / -x <SCALE> FracMinHash sketches: keep every hash below 2^64 / SCALE rather than the bottom -s." << endl
+        << "--sketch-scheme / -e <bottom|oph>  bottom-s sketches (default), or densified one-permutation sketches" << endl
+        << "                     compared slot by slot (see stream)." << endl
         << endl;
 }
 
@@ -235,60 +278,76 @@ void parse_fastas(vector<char*>& files,
     }
 }
 
-void parse_fastas(vector<char*>& files,
+/**
+ * Read every record of files into seq_keys/seq_seqs/seq_lens (and seq_quals,
+ * if not NULL: seq_lens bytes each, or NULL for a record without qualities,
+ * e.g. from FASTA). The files are parsed concurrently, one per OpenMP thread,
+ * and their records appended in file order.
+ */
+void parse_fasta_files(vector<char*>& files,
         vector<string>& seq_keys,
         vector<char*>& seq_seqs,
-        vector<int>& seq_lens){
+        vector<int>& seq_lens,
+        vector<char*>* seq_quals){
+
+    vector<vector<string> > file_keys(files.size());
+    vector<vector<char*> > file_seqs(files.size());
+    vector<vector<int> > file_lens(files.size());
+    vector<vector<char*> > file_quals(files.size());
 
-    kseq_t *seq;
+#pragma omp parallel for schedule(dynamic, 1)
     for (int i = 0; i < files.size(); i++){
-        char* f = files[i];
-        gzFile fp;
-        int l;
-        fp = gzopen(f, "r");
-        seq = kseq_init(fp);
+        gzFile fp = gzopen(files[i], "r");
+        if (fp == NULL){
+            cerr << "Could not open " << files[i] << endl;
+            exit(1);
+        }
+        kseq_t* seq = kseq_init(fp);
         // Read in reads, cluster, spit it back out
-        while ((l = kseq_read(seq)) >= 0) {
+        while (kseq_read(seq) >= 0) {
             to_upper(seq->seq.s, seq->seq.l);
 
             char * x = new char[seq->seq.l];
             memcpy(x, seq->seq.s, seq->seq.l);
-            seq_keys.push_back( string(seq->name.s) );
-            seq_seqs.push_back(x);
-            seq_lens.push_back(seq->seq.l);
-        } 
+            file_keys[i].push_back( string(seq->name.s) );
+            file_seqs[i].push_back(x);
+            file_lens[i].push_back(seq->seq.l);
+            if (seq_quals != NULL){
+                char* q = NULL;
+                if (seq->qual.l > 0){
+                    q = new char[seq->qual.l];
+                    memcpy(q, seq->qual.s, seq->qual.l);
+                }
+                file_quals[i].push_back(q);
+            }
+        }
+        kseq_destroy(seq);
         gzclose(fp);
-    }   
-    kseq_destroy(seq);
+    }
+
+    for (int i = 0; i < files.size(); i++){
+        seq_keys.insert(seq_keys.end(), file_keys[i].begin(), file_keys[i].end());
+        seq_seqs.insert(seq_seqs.end(), file_seqs[i].begin(), file_seqs[i].end());
+        seq_lens.insert(seq_lens.end(), file_lens[i].begin(), file_lens[i].end());
+        if (seq_quals != NULL){
+            seq_quals->insert(seq_quals->end(), file_quals[i].begin(), file_quals[i].end());
+        }
+    }
 }
 
 void parse_fastas(vector<char*>& files,
         vector<string>& seq_keys,
         vector<char*>& seq_seqs,
-        vector<int>& seq_lens,
-        vector<string>& seq_quals){
-
-    kseq_t *seq;
-    for (int i = 0; i < files.size(); i++){
-        char* f = files[i];
-        gzFile fp;
-        int l;
-        fp = gzopen(f, "r");
-        seq = kseq_init(fp);
-        // Read in reads, cluster, spit it back out
-        while ((l = kseq_read(seq)) >= 0) {
-            to_upper(seq->seq.s, seq->seq.l);
+        vector<int>& seq_lens){
+    parse_fasta_files(files, seq_keys, seq_seqs, seq_lens, NULL);
+}
 
-            char * x = new char[seq->seq.l];
-            memcpy(x, seq->seq.s, seq->seq.l);
-            seq_keys.push_back(seq->name.s);
-            seq_seqs.push_back(x);
-            seq_lens.push_back(seq->seq.l);
-            seq_quals.emplace_back(seq->qual.s);
-        } 
-        gzclose(fp);
-    }   
-    kseq_destroy(seq);
+void parse_fastas(vector<char*>& files,
+        vector<string>& seq_keys,
+        vector<char*>& seq_seqs,
+        vector<int>& seq_lens,
+        vector<char*>& seq_quals){
+    parse_fasta_files(files, seq_keys, seq_seqs, seq_lens, &seq_quals);
 }
 void hash_sequences(vector<string>& keys,
         unordered_map<string, char*>& name_to_seq,
@@ -315,16 +374,15 @@ void hash_sequences(vector<string>& keys,
         HASHTCounter& read_hash_counter,
         HASHTCounter& ref_hash_counter,
         bool doReadDepth,
-        bool doReferenceDepth){
+        bool doReferenceDepth,
+        const hash_scheme_t& scheme = hash_scheme_t()){
 
 
     if (doReadDepth){
 #pragma omp parallel for
         for (int i = 0; i < keys.size(); i++){
             // Hash sequence
-            vector<hash_t> r = calc_hashes(seqs[i], lengths[i], kmer);
-            hashes[i] = &(*r.begin());
-            hash_lengths[i] = r.size();
+            calc_hashes(seqs[i], lengths[i], kmer, hashes[i], hash_lengths[i], scheme);
             // TODO this is awful. There has to be a safe way around it.
             //#pragma omp critical
             {
@@ -340,9 +398,7 @@ void hash_sequences(vector<string>& keys,
     else if (doReferenceDepth){
 #pragma omp parallel for
         for (int i = 0; i < keys.size(); i++){
-            vector<hash_t> r = calc_hashes(seqs[i], lengths[i], kmer);
-            hashes[i] = &(*r.begin());
-            hash_lengths[i] = r.size();
+            calc_hashes(seqs[i], lengths[i], kmer, hashes[i], hash_lengths[i], scheme);
 
             // create the set of hashes in the sample
             set<hash_t> sample_set (hashes[i], hashes[i] + hash_lengths[i]);
@@ -360,9 +416,7 @@ void hash_sequences(vector<string>& keys,
     else{
 #pragma omp parallel for
         for (int i = 0; i < keys.size(); i++){
-            vector<hash_t> r = calc_hashes(seqs[i], lengths[i], kmer);
-            hashes[i] =&(*r.begin());
-            hash_lengths[i] = r.size();
+            calc_hashes(seqs[i], lengths[i], kmer, hashes[i], hash_lengths[i], scheme);
         }
 
     }
@@ -389,9 +443,7 @@ void hash_sequences(vector<string>& keys,
 #pragma omp parallel for
         for (int i = 0; i < keys.size(); i++){
             // Hash sequence
-            vector<hash_t> r = calc_hashes(seqs[i], lengths[i], kmer);
-            hashes[i] = &(*r.begin());
-            hash_lengths[i] = r.size();
+            calc_hashes(seqs[i], lengths[i], kmer, hashes[i], hash_lengths[i]);
             // TODO this is awful. There has to be a safe way around it.
             {
                 for (int j = 0; j < hash_lengths[i]; j++){
@@ -404,9 +456,7 @@ void hash_sequences(vector<string>& keys,
     else if (doReferenceDepth){
 #pragma omp parallel for
         for (int i = 0; i < keys.size(); i++){
-            vector<hash_t> r = calc_hashes(seqs[i], lengths[i], kmer);
-            hashes[i] = &(*r.begin());
-            hash_lengths[i] = r.size();
+            calc_hashes(seqs[i], lengths[i], kmer, hashes[i], hash_lengths[i]);
 
             // create the set of hashes in the sample
             set<hash_t> sample_set (hashes[i], hashes[i] + hash_lengths[i]);
@@ -423,41 +473,127 @@ void hash_sequences(vector<string>& keys,
     else{
 #pragma omp parallel for
         for (int i = 0; i < keys.size(); i++){
-            vector<hash_t> r = calc_hashes(seqs[i], lengths[i], kmer);
-            hashes[i] = &(*r.begin());
-            hash_lengths[i] = r.size();
+            calc_hashes(seqs[i], lengths[i], kmer, hashes[i], hash_lengths[i]);
         }
 
     }
 
 }
 
-string sketch_to_json(string key,
-        vector<hash_t> mins,
-        int sketchlen,
-        vector<int> kmer,
-        int sketch_size){
+// hashType of sketches made with -H rolling
+#define RKMH_ROLLING_HASH_TYPE "rkmh_rolling_2bit_splitmix64"
 
+/** One sketch in the layout of `mash info -d`. */
+json sketch_to_json(string key,
+        hash_t* mins,
+        int sketchlen){
+    json j;
+    j["name"] = key;
+    j["hashes"] = vector<hash_t>(mins, mins + sketchlen);
+    return j;
 }
-void sketches_to_jsons(vector<string>& keys,
-        vector<vector<hash_t> >& mins,
+
+/**
+ * Sketches as JSON in the layout of `mash info -d`, plus a "canonicalization"
+ * field recording how canonical kmers were picked (see canonical_mode_t),
+ * which load_hashes reads back. Rolling hashes get their own hashType.
+ */
+json sketches_to_json(vector<string>& keys,
+        vector<hash_t*>& mins,
         vector<int>& sketchlens,
         vector<int>& kmer,
-        int sketch_size){
-    cout << "[" << endl;
+        int sketch_size,
+        const hash_scheme_t& scheme = hash_scheme_t()){
+    json j;
+    if (kmer.size() == 1){
+        j["kmer"] = kmer[0];
+    }
+    else{
+        j["kmer"] = kmer;
+    }
+    j["alphabet"] = "ACGT";
+    j["preserveCase"] = false;
+    j["canonical"] = true;
+    j["canonicalization"] = scheme.canonical == CANONICAL_MIN_HASH ? "min-hash" : "lexicographic";
+    j["sketchSize"] = sketch_size;
+    j["hashType"] = scheme.fn == HASH_ROLLING ? RKMH_ROLLING_HASH_TYPE : "MurmurHash3_x64_128";
+    j["hashBits"] = 64;
+    j["hashSeed"] = 42;
+    j["sketches"] = json::array();
     for (int i = 0; i < keys.size(); ++i){
-        cout << sketch_to_json(keys[i], mins[i], sketchlens[i], kmer, sketch_size);
+        j["sketches"].push_back(sketch_to_json(keys[i], mins[i], sketchlens[i]));
+    }
+    return j;
+}
+
+/**
+ * Write sketches as rkmh JSON (see sketches_to_json)
+ * to outfile, or STDOUT if outfile is "-".
+ */
+void rkmh_json_output(vector<string>& keys,
+        vector<hash_t*>& mins,
+        vector<int>& sketchlens,
+        vector<int>& kmer,
+        int sketch_size,
+        string outfile,
+        const hash_scheme_t& scheme = hash_scheme_t()){
+    json j = sketches_to_json(keys, mins, sketchlens, kmer, sketch_size, scheme);
+    if (outfile == "-"){
+        cout << j << endl;
+        return;
+    }
+    ofstream ofi(outfile);
+    ofi << j << endl;
+    if (!ofi){
+        cerr << "Could not write JSON sketches to " << outfile << endl;
+        exit(1);
     }
-    cout << "]" << endl;
 }
 
 
-void rkmh_binary_output(vector<string> keys,
-        vector<vector<hash_t> >& mins,
-        vector<int> sketchlens,
+/**
+ * Write sketches as an rkmh sketch database (see sketch_db.hpp)
+ * to outfile, or STDOUT if outfile is "-". With write_index, the
+ * reference index of its sketches goes beside it (see ref_index.hpp).
+ */
+void rkmh_binary_output(vector<string>& keys,
+        vector<hash_t*>& mins,
+        vector<int>& sketchlens,
         vector<int>& kmer,
-        int sketch_size){
+        int sketch_size,
+        string outfile,
+        hash_fn_t fn = HASH_MURMUR3,
+        const vector<const uint64_t*>* locs = NULL,
+        bool write_index = false){
+    if (!write_sketch_db(outfile, keys, mins, sketchlens, kmer, sketch_size, 42, true, fn, locs)){
+        cerr << "Could not write sketch database " << outfile << endl;
+        exit(1);
+    }
+    if (write_index){
+        RefIndex index(mins.data(), sketchlens.data(), mins.size());
+        if (!index.save(outfile + RKMH_REF_INDEX_SUFFIX, kmer, fn, sketch_size)){
+            cerr << "Could not write reference index " << outfile + RKMH_REF_INDEX_SUFFIX << endl;
+            exit(1);
+        }
+    }
+}
 
+/**
+ * Index the reference sketches in refs, loading the index `hash --index` saved
+ * beside db_file (if not NULL) when it was built from exactly these sketches.
+ */
+void reference_index(RefIndex& index, const SketchMatrix& refs, const char* db_file,
+        const vector<int>& kmer, hash_fn_t fn, int sketch_size){
+    if (db_file != NULL){
+        string index_file = string(db_file) + RKMH_REF_INDEX_SUFFIX;
+        if (index.load(index_file, refs, kmer, fn, sketch_size)){
+            return;
+        }
+        if (access(index_file.c_str(), F_OK) == 0){
+            cerr << index_file << " is corrupt or indexes other sketches than " << db_file << "; rebuilding the index." << endl;
+        }
+    }
+    index = RefIndex(refs);
 }
 
 void print_wabbit(string key,
@@ -549,41 +685,267 @@ json dump_hashes(vector<string> keys,
     return j;
 }
 
-std::tuple<vector<string> ,
-    vector<int> ,
-    vector<vector<hash_t> > ,
-    vector<int> ,
-    int> load_hashes(json jj){
-        cout << jj << endl;
-        cerr << "Loading not implemented" << endl;
+/**
+ * Sketches read from JSON, along with the parameters they were built with.
+ */
+struct json_sketches_t{
+    vector<string> keys;
+    vector<vector<hash_t> > sketches;
+    vector<int> kmer;
+    int sketch_size = 0;
+    uint64_t hash_seed = 42;
+    hash_fn_t fn = HASH_MURMUR3;
+    canonical_mode_t canonical = CANONICAL_MIN_HASH;
+};
+
+/**
+ * Parse precomputed sketches from JSON; source names the input in errors.
+ * Accepts rkmh's own JSON (sketches_to_json), Mash's `mash info -d`
+ * output with 64-bit hashes, and sourmash signatures holding num
+ * (bottom-s) sketches. Mash and sourmash hash the lexicographically
+ * smaller strand of each kmer; rkmh's own JSON may also hold rolling hashes. Only one kmer size is taken from
+ * sourmash signatures: kmer[0], or the first one found if kmer is empty.
+ */
+json_sketches_t load_hashes(json& jj, const string& source, const vector<int>& kmer){
+    json_sketches_t ret;
+    auto fail = [&](const string& why){
+        cerr << source << " " << why << endl;
         exit(1);
+    };
 
+    try{
+        if (jj.is_object() && jj.count("sketches")){
+            string hash_type = jj.value("hashType", string("MurmurHash3_x64_128"));
+            if ((hash_type != "MurmurHash3_x64_128" && hash_type != RKMH_ROLLING_HASH_TYPE) ||
+                    jj.value("hashBits", 64) != 64){
+                fail("does not hold 64-bit MurmurHash3_x64_128 sketches.");
+            }
+            ret.fn = hash_type == RKMH_ROLLING_HASH_TYPE ? HASH_ROLLING : HASH_MURMUR3;
+            if (!jj.value("canonical", true)){
+                fail("holds non-canonical sketches.");
+            }
+            string alphabet = jj.value("alphabet", string("ACGT"));
+            std::sort(alphabet.begin(), alphabet.end());
+            if (alphabet != "ACGT"){
+                fail("was sketched over an alphabet other than ACGT.");
+            }
+            if (jj.at("kmer").is_array()){
+                ret.kmer = jj["kmer"].get<vector<int> >();
+            }
+            else{
+                ret.kmer.push_back(jj["kmer"].get<int>());
+            }
+            ret.sketch_size = jj.at("sketchSize").get<int>();
+            ret.hash_seed = jj.value("hashSeed", (uint64_t) 42);
+            // anything but our own output follows Mash
+            ret.canonical = jj.value("canonicalization", string("lexicographic")) == "min-hash" ?
+                CANONICAL_MIN_HASH : CANONICAL_LEXICOGRAPHIC;
+            for (auto& sk : jj.at("sketches")){
+                ret.keys.push_back(sk.at("name").get<string>());
+                ret.sketches.push_back(sk.at("hashes").get<vector<hash_t> >());
+            }
+        }
+        else{
+            // sourmash: one signature or a list of them, each with a sketch per kmer size
+            json sigs = jj.is_array() ? jj : json::array({jj});
+            for (auto& sig : sigs){
+                if (!sig.is_object() || !sig.count("signatures")){
+                    fail("is not rkmh, Mash or sourmash JSON.");
+                }
+                if (sig.value("hash_function", string("0.murmur64")) != "0.murmur64"){
+                    fail("was not sketched with sourmash's 0.murmur64 hash.");
+                }
+                string name = sig.value("name", sig.value("filename", string("")));
+                for (auto& mh : sig.at("signatures")){
+                    string molecule = mh.value("molecule", string("DNA"));
+                    if (molecule != "DNA" && molecule != "dna"){
+                        continue;
+                    }
+                    int ksize = mh.at("ksize").get<int>();
+                    if (ret.kmer.empty()){
+                        ret.kmer.push_back(kmer.empty() ? ksize : kmer[0]);
+                    }
+                    if (ksize != ret.kmer[0]){
+                        continue;
+                    }
+                    int num = mh.value("num", 0);
+                    if (num == 0){
+                        fail("holds scaled sourmash sketches; only num sketches can be used.");
+                    }
+                    if (ret.sketch_size == 0 || num < ret.sketch_size){
+                        ret.sketch_size = num;
+                    }
+                    uint64_t seed = mh.value("seed", (uint64_t) 42);
+                    if (seed != 42){
+                        ret.hash_seed = seed;
+                    }
+                    ret.keys.push_back(name);
+                    ret.sketches.push_back(mh.at("mins").get<vector<hash_t> >());
+                }
+            }
+            if (ret.keys.empty()){
+                fail("has no DNA sketches of the requested kmer size.");
+            }
+            ret.canonical = CANONICAL_LEXICOGRAPHIC;
+        }
     }
+    catch (json::exception& e){
+        fail(string("is not a valid sketch file: ") + e.what());
+    }
+    return ret;
+}
 
-std::tuple<vector<string>,
-    vector<int> ,
-    vector<vector<hash_t> >,
-    vector<int> ,
-    int> load_hashes(istream ifi){
-        json jj;
-        ifi >> jj;
-        return load_hashes(jj);
+json_sketches_t load_hashes(string filename, const vector<int>& kmer){
+    json jj;
+    try{
+        if (filename == "-"){
+            cin >> jj;
+        }
+        else{
+            ifstream ifi(filename);
+            if (!ifi){
+                cerr << "Could not open " << filename << endl;
+                exit(1);
+            }
+            ifi >> jj;
+        }
+    }
+    catch (json::exception& e){
+        cerr << filename << " is not valid JSON: " << e.what() << endl;
+        exit(1);
     }
+    return load_hashes(jj, filename, kmer);
+}
 
+/**
+ * Exit if scaled sketches (-x) were asked for along with precomputed ones,
+ * which are all bottom-s sketches and can't be compared with them.
+ */
+void check_scaled(uint64_t scale, vector<char*>& pre_ref_files, vector<char*>& pre_read_files){
+    if (scale > 0 && (!pre_ref_files.empty() || !pre_read_files.empty())){
+        cerr << "Scaled sketches (-x) can't be compared with precomputed sketches (-R / -F)." << endl;
+        exit(1);
+    }
+}
 
+/**
+ * Exit if b-bit sketches (--bits) were asked for with a bit width other than 1, 2 or 4,
+ * or if one-permutation sketches (--bits or --sketch-scheme oph) were asked for with
+ * options that need bottom sketches: precomputed sketches, -x or -P.
+ */
+void check_one_perm(int bits, sketch_scheme_t sketch_scheme, uint64_t scale, bool positions,
+        vector<char*>& pre_ref_files, vector<char*>& pre_read_files){
+    if (bits != 0 && !valid_bbit_bits(bits)){
+        cerr << "b-bit sketches (--bits) keep 1, 2 or 4 bits per slot, not " << bits << "." << endl;
+        exit(1);
+    }
+    if (bits == 0 && sketch_scheme == SKETCH_BOTTOM){
+        return;
+    }
+    if (scale > 0 || positions || !pre_ref_files.empty() || !pre_read_files.empty()){
+        cerr << "One-permutation sketches (--bits / --sketch-scheme oph) can't be used with -x, -P or precomputed sketches (-R / -F)." << endl;
+        exit(1);
+    }
+}
 
+/**
+ * Load precomputed sketches (-R / -F): rkmh sketch databases, mapped in place
+ * (see load_sketch_dbs), then JSON sketches (see load_hashes), copied. Appends them
+ * to keys/mins/min_lens and returns how many came from databases; those come first
+ * and must not be deleted. The databases are appended to dbs.
+ *
+ * kmer is set from the first file if empty, as is scheme.canonical unless canonical_set.
+ * Exits if a file disagrees with either, was hashed with a function other than
+ * scheme.fn or a seed other than 42, or has sketches smaller than sketch_size;
+ * larger ones are truncated.
+ * If locs is given, each sketch's locations (NULL unless it came from a located database) are appended to it.
+ */
+int load_precomputed_sketches(vector<char*>& files,
+        vector<int>& kmer,
+        int sketch_size,
+        hash_scheme_t& scheme,
+        bool& canonical_set,
+        vector<string>& keys,
+        vector<hash_t*>& mins,
+        vector<int>& min_lens,
+        vector<SketchDB*>& dbs,
+        vector<const uint64_t*>* locs = NULL){
+
+    vector<char*> db_files;
+    vector<char*> json_files;
+    for (auto f : files){
+        if (SketchDB::is_sketch_db(f)){
+            db_files.push_back(f);
+        }
+        else{
+            json_files.push_back(f);
+        }
+    }
 
-std::tuple<vector<string> ,
-    vector<int> ,
-    vector<vector<hash_t> >,
-    vector<int>,
-    int> load_hashes(string filename){
+    auto check_canonical = [&](char* f, canonical_mode_t mode){
+        if (!canonical_set){
+            scheme.canonical = mode;
+            canonical_set = true;
+        }
+        else if (mode != scheme.canonical){
+            cerr << f << " picks canonical kmers differently (rkmh vs. Mash/sourmash) than the other precomputed sketches." << endl;
+            exit(1);
+        }
+    };
 
+    for (auto f : db_files){
+        check_canonical(f, CANONICAL_MIN_HASH);
+    }
+    size_t num_before = keys.size();
+    load_sketch_dbs(db_files, kmer, sketch_size, keys, mins, min_lens, dbs, scheme.fn, locs);
+    int num_db = keys.size() - num_before;
+
+    for (auto f : json_files){
+        json_sketches_t loaded = load_hashes(string(f), kmer);
+        check_canonical(f, loaded.canonical);
+        if (loaded.fn != scheme.fn){
+            cerr << f << " was sketched with " << hash_fn_name(loaded.fn) << " hashes; pass -H " <<
+                hash_fn_name(loaded.fn) << " to use it." << endl;
+            exit(1);
+        }
+        if (kmer.empty()){
+            kmer = loaded.kmer;
+        }
+        if (loaded.kmer != kmer){
+            cerr << f << " was sketched with different kmer sizes than requested." << endl;
+            exit(1);
+        }
+        if (loaded.hash_seed != 42){
+            cerr << f << " was sketched with hash seed " << loaded.hash_seed << "; rkmh uses 42." << endl;
+            exit(1);
+        }
+        if (loaded.sketch_size < sketch_size){
+            cerr << f << " has sketches of size " << loaded.sketch_size <<
+                ", smaller than the requested sketch size " << sketch_size << "." << endl;
+            exit(1);
+        }
+        for (int i = 0; i < loaded.keys.size(); ++i){
+            vector<hash_t>& sk = loaded.sketches[i];
+            std::sort(sk.begin(), sk.end());
+            int len = std::min((int) sk.size(), sketch_size);
+            hash_t* x = new hash_t[len];
+            memcpy(x, sk.data(), len * sizeof(hash_t));
+            keys.push_back(loaded.keys[i]);
+            mins.push_back(x);
+            min_lens.push_back(len);
+            if (locs != NULL){
+                locs->push_back(NULL);
+            }
+        }
     }
+    return num_db;
+}
 
 int main_stream(int argc, char** argv){
     vector<char*> ref_files;
     vector<char*> read_files;
+    vector<char*> r1_files;
+    vector<char*> r2_files;
     vector<char*> pre_read_files;
     vector<char*> pre_ref_files;
 
@@ -593,7 +955,7 @@ int main_stream(int argc, char** argv){
     int threads = 1;
     int min_kmer_occ = -1;
     int min_matches = -1;
-    int min_diff = 0;
+    int min_diff = -1;
     int max_samples = 100000;
 
     string read_kmer_map_file = "";
@@ -609,9 +971,21 @@ int main_stream(int argc, char** argv){
     bool output_reads = false;
     bool merge_sketch = false;
 
+    uint64_t ref_mem_mb = 1024;
+    uint64_t read_batch_bytes = 1 << 26;
+    bool in_order = false;
+    bool tag_files = false;
+    bool positions = false;
+    int bits = 0;
+    sketch_scheme_t sketch_scheme = SKETCH_BOTTOM;
+    hash_scheme_t scheme;
+    uint64_t scale = 0;
+
+    // long-only options (-b is hash's sketch database output)
+    const int OPT_BITS = 256;
+
     // TODO still need:
     // prehashed depth map for reads/ref
-    // prehashed reads / refs
     //
 
     int c;
@@ -643,11 +1017,21 @@ int main_stream(int argc, char** argv){
             {"in-stream", no_argument, 0, 'i'},
             {"output-reads", no_argument, 0, 'z'},
             {"merge-sketch", no_argument, 0, 'm'},
+            {"ref-mem", required_argument, 0, 'B'},
+            {"in-order", no_argument, 0, 'O'},
+            {"r1", required_argument, 0, '1'},
+            {"r2", required_argument, 0, '2'},
+            {"tag-files", no_argument, 0, 'T'},
+            {"hash", required_argument, 0, 'H'},
+            {"scaled", required_argument, 0, 'x'},
+            {"positions", no_argument, 0, 'P'},
+            {"bits", required_argument, 0, OPT_BITS},
+            {"sketch-scheme", required_argument, 0, 'e'},
             {0,0,0,0}
         };
 
         int option_index = 0;
-        c = getopt_long(argc, argv, "zmhdk:f:r:s:S:t:M:N:I:R:F:p:q:iD:", long_options, &option_index);
+        c = getopt_long(argc, argv, "zmhdOTPk:f:r:s:S:t:M:N:I:R:F:p:q:iD:B:1:2:H:x:e:", long_options, &option_index);
         if (c == -1){
             break;
         }
@@ -656,6 +1040,45 @@ int main_stream(int argc, char** argv){
             case 'm':
                 merge_sketch = true;
                 break;
+            case 'P':
+                positions = true;
+                break;
+            case OPT_BITS:
+                bits = atoi(optarg);
+                break;
+            case 'e':
+                if (!parse_sketch_scheme(optarg, sketch_scheme)){
+                    cerr << "Unknown sketch scheme " << optarg << "; use bottom or oph." << endl;
+                    exit(1);
+                }
+                break;
+            case 'B':
+                ref_mem_mb = atoi(optarg);
+                break;
+            case 'O':
+                in_order = true;
+                break;
+            case 'T':
+                tag_files = true;
+                break;
+            case '1':
+                r1_files.push_back(optarg);
+                break;
+            case '2':
+                r2_files.push_back(optarg);
+                break;
+            case 'H':
+                if (!parse_hash_fn(optarg, scheme.fn)){
+                    cerr << "Unknown hash function " << optarg << "; use murmur or rolling." << endl;
+                    exit(1);
+                }
+                break;
+            case 'x':
+                if (!parse_scale(optarg, scale)){
+                    cerr << "-x takes a whole number of at least 1, not " << optarg << "." << endl;
+                    exit(1);
+                }
+                break;
             case 'F':
                 pre_read_files.push_back(optarg);
                 break;
@@ -725,7 +1148,8 @@ int main_stream(int argc, char** argv){
         sketch_size = 1000;
     }
 
-    if (kmer.size() == 0){
+    // Precomputed sketches (-R / -F) carry their own kmer sizes
+    if (kmer.size() == 0 && pre_ref_files.empty() && pre_read_files.empty()){
         cerr << "No kmer size(s) provided. Will use a default kmer size of 16." << endl;
         kmer.push_back(16);
     }
@@ -769,219 +1193,309 @@ int main_stream(int argc, char** argv){
     }**/
 
     vector<string> ref_keys;
-    vector<char*> ref_seqs;
-    vector<int> ref_lens;
-
-    vector<string> read_keys;
-    vector<char*> read_seqs;
-    vector<int> read_lens;
+    vector<hash_t*> ref_minhashes;
+    vector<int> ref_min_lens;
+    // where each reference hash came from, with -P (NULL for references without positions)
+    vector<const uint64_t*> ref_locs;
+
+    check_scaled(scale, pre_ref_files, pre_read_files);
+    check_one_perm(bits, sketch_scheme, scale, positions, pre_ref_files, pre_read_files);
+    // b-bit sketches are one-permutation sketches, densified or not
+    if (bits > 0 && sketch_scheme == SKETCH_BOTTOM){
+        sketch_scheme = SKETCH_ONE_PERM;
+    }
 
-    
- 
-    bool stream_files = false;
+    // Precomputed sketches (-R / -F) are used as they are, and everything
+    // hashed here must pick canonical kmers the same way they did.
+    bool canonical_set = false;
+    vector<SketchDB*> sketch_dbs;
+    int num_db_refs = load_precomputed_sketches(pre_ref_files, kmer, sketch_size, scheme, canonical_set,
+            ref_keys, ref_minhashes, ref_min_lens, sketch_dbs, positions ? &ref_locs : NULL);
+    // Read sketches are loaded a file at a time to remember where each came from.
+    vector<string> pre_read_keys;
+    vector<hash_t*> pre_read_mins;
+    vector<int> pre_read_min_lens;
+    vector<int> pre_read_file_ids;
+    vector<bool> pre_read_owned;
+    for (int f = 0; f < pre_read_files.size(); ++f){
+        vector<char*> one = {pre_read_files[f]};
+        int num_db = load_precomputed_sketches(one, kmer, sketch_size, scheme, canonical_set,
+                pre_read_keys, pre_read_mins, pre_read_min_lens, sketch_dbs);
+        pre_read_file_ids.resize(pre_read_keys.size(), f);
+        pre_read_owned.resize(pre_read_keys.size(), num_db == 0);
+    }
+    check_kmer_sizes(scheme, kmer);
+    hash_t max_hash = scaled_max_hash(scale);
 
+    // Sketch references as they are read so that only a bounded
+    // amount of reference sequence is ever resident.
     if (!ref_files.empty()){
-        parse_fastas(ref_files, ref_keys, ref_seqs, ref_lens);
+        sketch_reference_files(ref_files, kmer, sketch_size, ref_mem_mb << 20,
+                ref_keys, ref_minhashes, ref_min_lens,
+                doReferenceDepth ? ref_hash_counter : NULL, max_samples, false, scheme, max_hash,
+                positions ? &ref_locs : NULL, sketch_scheme);
     }
-    if (!read_files.empty() && !stream_files){
-        parse_fastas(read_files, read_keys, read_seqs, read_lens);
-    }
-
-    char** rseqs = new char*[read_seqs.size()];
 
-    for (int i = 0; i < read_seqs.size(); ++i){
-        rseqs[i] = read_seqs[i];
+    // With --bits, only the packed b-bit sketches are kept.
+    BbitPanel ref_panel(sketch_size, bits > 0 ? bits : 1);
+    if (bits > 0){
+        for (int i = 0; i < ref_keys.size(); ++i){
+            ref_panel.add(ref_minhashes[i]);
+            ref_min_lens[i] = 0;
+        }
+        cerr << "Packed " << ref_keys.size() << " reference sketches into " << ref_panel.bytes() / 1024 << " KB." << endl;
     }
 
-    hash_t** read_hashes = new hash_t*[read_keys.size()];
-    vector<int> read_hash_lens(read_keys.size());
-
-    hash_t** read_mins = new hash_t*[read_keys.size()];
-    vector<int> read_min_lens(read_keys.size());
+    // Reference sketches are compared from one matrix: the database's own
+    // mapping if they all came from a single one, otherwise a copy, after
+    // which the separate sketches are freed.
+    SketchMatrix* ref_matrix;
+    const char* ref_db = NULL;
+    if (ref_files.empty() && pre_ref_files.size() == 1 && num_db_refs > 0 && num_db_refs == ref_keys.size()){
+        ref_matrix = new SketchMatrix(*sketch_dbs[0], sketch_size);
+        // a saved index covers whole sketches, so not a smaller -s
+        ref_db = sketch_size == sketch_dbs[0]->sketch_size() ? pre_ref_files[0] : NULL;
+    }
+    else{
+        ref_matrix = new SketchMatrix(ref_keys, ref_minhashes.data(), ref_min_lens.data());
+    }
+    for (int i = num_db_refs; i < ref_minhashes.size(); ++i){
+        delete [] ref_minhashes[i];
+    }
+    vector<hash_t*>().swap(ref_minhashes);
+    vector<string>().swap(ref_keys);
+    int numrefs = ref_matrix->size();
+
+    // Bottom sketches are compared through an index of the reference sketches,
+    // so each read costs a lookup per hash rather than an intersection per reference.
+    RefIndex ref_index;
+    if (bits == 0 && sketch_scheme == SKETCH_BOTTOM){
+        reference_index(ref_index, *ref_matrix, ref_db, kmer, scheme.fn, sketch_size);
+    }
 
+    // One-permutation and --bits sketches are compared with every reference, so
+    // reads are classified a tile at a time against tiles of references,
+    // sized so both stay in the level 2 cache (see tiled_top_two). Reads
+    // per tile are capped so a batch still splits into enough tasks.
+    uint64_t row_bytes = bits > 0 ? ref_panel.row_words() * sizeof(uint64_t) : sketch_size * sizeof(hash_t);
+    int ref_tile = tile_rows(row_bytes, 0.5);
+    int read_tile = 1;
+    if (bits > 0 || sketch_scheme != SKETCH_BOTTOM){
+        read_tile = std::min(tile_rows(row_bytes, 0.25), 256);
+    }
 
-    hash_t** ref_hashes = new hash_t*[ref_keys.size()];
-    vector<int> ref_hash_lens(ref_keys.size());
+    // Reads come from the -f files and then STDIN (-i), a batch at a time.
+    // Each batch is classified against the resident reference sketches
+    // and freed, so memory stays flat no matter how many reads there are.
+    //
+    // Thanks heavens for https://biowize.wordpress.com/2013/03/05/using-kseq-h-with-stdin/
+    vector<char*> stream_files(read_files);
+    if (streamify_me_capn){
+        stream_files.push_back((char*) "-");
+    }
 
-    hash_t** ref_minhashes = new hash_t*[ref_keys.size()];
-    vector<int> ref_min_lens(ref_keys.size());
+    // Kmer depth filtering needs the depth of every read kmer before
+    // the first read can be sketched, so count them in a first pass.
+    if (doReadDepth){
+        if (streamify_me_capn){
+            cerr << "Kmer depth filtering (-M) needs two passes over the reads and cannot be used with STDIN (-i)." << endl;
+            exit(1);
+        }
+        if (!pre_read_files.empty()){
+            cerr << "Kmer depth filtering (-M) needs read sequence and cannot be used with precomputed read sketches (-F)." << endl;
+            exit(1);
+        }
+        vector<char*> count_files(stream_files);
+        count_files.insert(count_files.end(), r1_files.begin(), r1_files.end());
+        count_files.insert(count_files.end(), r2_files.begin(), r2_files.end());
+        MultiFileBatchReader counter_reader(count_files, read_batch_bytes);
+        counter_reader.use_scheme(scheme);
+        pipelined_for_each(counter_reader,
+                [&](seq_batch_t& b){},
+                [&](seq_batch_t& b, int i){
+                    b.each_hash(i, kmer, [&](const hash_t* h, int n){
+                            for (int j = 0; j < n; ++j){
+                                read_hash_counter->increment(h[j]);
+                            }
+                            });
+                });
+    }
 
-   
-    int numrefs = ref_keys.size();
-    int numreads = read_keys.size();
+    ResultWriter writer(stdout, in_order);
 
-    #pragma omp parallel
-    {
-        if (!doReferenceDepth){
-            #pragma omp for
-            for (int i = 0; i < numrefs; ++i){
-                to_upper(ref_seqs[i], ref_lens[i]);
-                //hash_t* h;
-                int num;
-                calc_hashes(ref_seqs[i], ref_lens[i], kmer, ref_hashes[i], num);
-                minhashes(ref_hashes[i], num, sketch_size, ref_minhashes[i], ref_min_lens[i]);
-                delete [] ref_hashes[i];
-                delete [] ref_seqs[i];
+    // Add a block of a read's hashes to its sketch, dropping those below the kmer depth cutoff.
+    auto sketch_block = [&](BottomSketcher& sk, const hash_t* h, int n){
+        for (int j = 0; j < n; ++j){
+            if (sk.wants(h[j]) && (!doReadDepth || read_hash_counter->get(h[j]) >= min_kmer_occ)){
+                sk.push(h[j]);
             }
+        }
+    };
 
+    // Score the sketches mins[0..n) (nums[r] hashes each) against the panel
+    // into tops. Bottom sketches go through ref_index a read at a time; the
+    // others tile by tile, from this thread's last best match, cutting short
+    // references that can't change a read's result.
+    auto classify_tile = [&](hash_t** mins, int* nums, top_two_t* tops, int n){
+        static thread_local int last_best = 0;
+        if (bits > 0){
+            int words = ref_panel.row_words();
+            uint64_t* packed = thread_arena().alloc<uint64_t>((uint64_t) n * words);
+            for (int r = 0; r < n; ++r){
+                ref_panel.pack(mins[r], packed + (uint64_t) r * words);
+            }
+            tiled_top_two(n, numrefs, ref_tile, last_best, tops, [&](int r, int j, int need) -> int{
+                return ref_panel.shared(j, packed + (uint64_t) r * words);
+            });
+        }
+        else if (sketch_scheme != SKETCH_BOTTOM){
+            tiled_top_two(n, numrefs, ref_tile, last_best, tops, [&](int r, int j, int need) -> int{
+                return one_perm_shared_above(ref_matrix->row(j), mins[r], std::min(nums[r], ref_matrix->row_len(j)), need);
+            });
         }
         else{
-            #pragma omp for
-            for (int i = 0; i < numrefs; ++i){
-                calc_hashes(ref_seqs[i], ref_lens[i], kmer, ref_hashes[i], ref_hash_lens[i], ref_hash_counter);
-            }
-            #pragma omp for
-            for (int i = 0; i < numrefs; ++i){
-                minhashes_frequency_filter(ref_hashes[i], ref_hash_lens[i], sketch_size,
-                 ref_minhashes[i], ref_min_lens[i], ref_hash_counter, 0, max_samples);
+            int* shared = thread_arena().alloc<int>(std::max(numrefs, 1));
+            for (int r = 0; r < n; ++r){
+                ref_index.count(mins[r], nums[r], shared);
+                for (int j = 0; j < numrefs; ++j){
+                    tops[r].offer(j, shared[j]);
+                }
             }
         }
-    
-        
+        if (n > 0 && tops[n - 1].best_id >= 0){
+            last_best = tops[n - 1].best_id;
+        }
+    };
 
-        if (!doReadDepth && !stream_files){
-    //#pragma omp single
-    {
-            #pragma omp for
-            for (int i = 0; i < numreads; ++i){
+    // Write a read's (or read pair's) best match as record index. file is
+    // the input it came from. With -x, the sketch size column is the read's
+    // own, so shared / size is its containment. With -P, the last column
+    // places the read on its best match. -D compares the best match with
+    // the runner-up. filled is the sketcher's filled(), for the depth test.
+    auto write_result = [&](hash_t* mins, int min_num, int filled, const top_two_t& top, const string& key, const char* file, uint64_t index){
+        int max_shared = top.best;
+        int max_id = std::max(top.best_id, 0);
+
+        bool diff_filter = max_shared - top.second > min_diff;
+        bool depth_filter = filled <= min_matches;
+        bool match_filter = max_shared < min_matches;
+
+        out_buf_t outre;
+        outre.append(ref_matrix->name_data(max_id), ref_matrix->name_len(max_id));
+        outre.append('\t');
+        outre.append(key);
+        outre.append('\t');
+        outre.append_int(max_shared);
+        outre.append('\t');
+        outre.append_int(scale > 0 ? min_num : sketch_size);
+        outre.append(depth_filter ? "FAIL:DEPTH" : "");
+        outre.append('\t');
+        outre.append(match_filter ? "FAIL:MATCHES" : "");
+        outre.append('\t');
+        outre.append(diff_filter ? "" : "FAIL:DIFF");
+        if (tag_files){
+            outre.append('\t');
+            outre.append(file);
+        }
+        if (positions){
+            outre.append('\t');
+            if (ref_locs[max_id] == NULL){
+                outre.append('*');
+            }
+            else{
+                outre.append_int(sketch_placement(mins, min_num, ref_matrix->row(max_id), ref_matrix->row_len(max_id),
+                            ref_locs[max_id], thread_arena()));
+            }
+        }
+        outre.append('\n');
+        writer.write(index, outre);
+    };
 
-                int shared_arr [numrefs];
-                hash_t* h;
-                int num;
-                hash_t* mins;
-                int min_num;
+    auto classify_and_write = [&](BottomSketcher& sk, const string& key, const char* file, uint64_t index){
+        hash_t* mins;
+        int min_num;
+        sk.finish(mins, min_num);
+        top_two_t top(-1, min_diff);
+        classify_tile(&mins, &min_num, &top, 1);
+        write_result(mins, min_num, sk.filled(), top, key, file, index);
+    };
 
-                //#pragma omp task depend(out: rseqs[i])
-                {
-                    to_upper(rseqs[i], read_lens[i]);
+    // Several input files are decoded concurrently (see MultiFileBatchReader).
+    MultiFileBatchReader read_reader(stream_files, read_batch_bytes);
+    read_reader.use_scheme(scheme);
+    // Each task sketches a tile of reads, which stay in its arena until
+    // the tile is classified and written.
+    uint64_t num_single = pipelined_for_each_block(read_reader,
+            [&](seq_batch_t& b){},
+            [&](seq_batch_t& b, int begin, int end){
+                int n = end - begin;
+                hash_t** mins = thread_arena().alloc<hash_t*>(n);
+                int* nums = thread_arena().alloc<int>(n);
+                int* filled = thread_arena().alloc<int>(n);
+                for (int r = 0; r < n; ++r){
+                    BottomSketcher sk(sketch_size, thread_arena(), max_hash, sketch_scheme);
+                    b.each_hash(begin + r, kmer, [&](const hash_t* h, int m){ sketch_block(sk, h, m); });
+                    sk.finish(mins[r], nums[r]);
+                    filled[r] = sk.filled();
                 }
-
-                //#pragma omp task depend(in: rseqs[i]) depend(out: h, num)
-                calc_hashes(rseqs[i], read_lens[i], kmer, h, num);
-
-                //#pragma omp task depend(in: h, num) depend(out: mins, min_num)
-                minhashes(h, num, sketch_size, mins, min_num);
-                delete [] h;
-                delete [] rseqs[i];
-
-                for (int j = 0; j < numrefs; ++j){
-                    //#pragma omp task depend(in: mins, min_num) depend(out: shared_arr)
-                        hash_intersection_size(mins, min_num, ref_minhashes[j], ref_min_lens[j], shared_arr[j]);
+                vector<top_two_t> tops(n, top_two_t(-1, min_diff));
+                classify_tile(mins, nums, tops.data(), n);
+                for (int r = 0; r < n; ++r){
+                    int i = begin + r;
+                    write_result(mins[r], nums[r], filled[r], tops[r], b.keys[i], stream_files[b.file_ids[i]], b.start + i);
                 }
-                //#pragma omp task depend(in: shared_arr)
-                {
-
-                    int max_shared = -1;
-                    int max_id = 0;
-                    int diff = 0;
-                    for (int j = 0; j < numrefs; ++j){
-                        if (shared_arr[j] > max_shared){
-                            diff = shared_arr[j] - max_shared;
-                            max_shared = shared_arr[j];
-                            max_id = j;
-                        }
+            }, read_tile);
+
+    // Read pairs get a single sketch built from the kmers of both mates
+    // and are reported once, under the name of the first mate.
+    uint64_t num_pairs = 0;
+    if (!r1_files.empty()){
+        PairedBatchReader pair_reader(r1_files, r2_files, read_batch_bytes);
+        pair_reader.use_scheme(scheme);
+        num_pairs = pipelined_for_each_block(pair_reader,
+                [&](pair_batch_t& b){},
+                [&](pair_batch_t& b, int begin, int end){
+                    int n = end - begin;
+                    hash_t** mins = thread_arena().alloc<hash_t*>(n);
+                    int* nums = thread_arena().alloc<int>(n);
+                    int* filled = thread_arena().alloc<int>(n);
+                    for (int r = 0; r < n; ++r){
+                        BottomSketcher sk(sketch_size, thread_arena(), max_hash, sketch_scheme);
+                        pair_each_hash(b, begin + r, kmer, [&](const hash_t* h, int m){ sketch_block(sk, h, m); });
+                        sk.finish(mins[r], nums[r]);
+                        filled[r] = sk.filled();
                     }
-
-                    //int* max_shared_ptr = std::max_element(shared_arr, shared_arr + numrefs);
-                    //int max_id = std::distance(shared_arr, max_shared_ptr);
-                    bool diff_filter = diff > min_diff;
-                    bool depth_filter = min_num <= min_matches;
-                    bool match_filter = max_shared < min_matches;
-
-                    stringstream outre;
-                    outre << ref_keys[max_id] << "\t" << read_keys[i]  <<  "\t" << max_shared << "\t" << sketch_size << (depth_filter ? "FAIL:DEPTH" : "") << "\t" << (match_filter ? "FAIL:MATCHES" : "") << "\t" << (diff_filter ? "" : "FAIL:DIFF") << endl;
-                    cout << outre.str();
-                    outre.str("");
-                    delete [] mins;
-
-                }
-           }
-
-        //#pragma omp taskwait
-    }
-        }
-        else if (doReadDepth && !stream_files){
-            #pragma omp for
-            for (int i = 0; i < numreads; ++i){
-                int shared_arr[numrefs];
-
-                to_upper(rseqs[i], read_lens[i]);
-                calc_hashes(rseqs[i], read_lens[i], kmer, read_hashes[i], read_hash_lens[i], read_hash_counter);
-            }
-            #pragma omp for
-            for (int i = 0; i < numreads; ++i){
-                hash_t* mins;
-                int num_mins;
-                int shared_arr[numrefs];
-                mask_by_frequency(read_hashes[i], read_hash_lens[i], read_hash_counter, min_kmer_occ);
-                minhashes(read_hashes[i], read_hash_lens[i], sketch_size, mins, num_mins);
-                delete [] read_hashes[i];
-                
-
-                for (int j = 0; j < numrefs; ++j){
-                        hash_intersection_size(mins, num_mins, ref_minhashes[j], ref_min_lens[j], shared_arr[j]);
-                }
- 
-                int max_shared = -1;
-                int max_id = 0;
-                int diff = 0;
-                for (int j = 0; j < numrefs; ++j){
-                    if (shared_arr[j] > max_shared){
-                        diff = shared_arr[j] - max_shared;
-                        max_shared = shared_arr[j];
-                        max_id = j;
+                    vector<top_two_t> tops(n, top_two_t(-1, min_diff));
+                    classify_tile(mins, nums, tops.data(), n);
+                    for (int r = 0; r < n; ++r){
+                        int i = begin + r;
+                        write_result(mins[r], nums[r], filled[r], tops[r], b.r1.keys[i], r1_files[b.r1.file_ids[i]], num_single + b.start + i);
                     }
-                }
-
-               
-                bool diff_filter = diff > min_diff;
-                bool depth_filter = num_mins <= min_matches;
-                bool match_filter = max_shared < min_matches;
-
+                }, read_tile);
+    }
 
-                stringstream outre;
-                //outre << ref_keys[max_id] << "\t" << read_keys[i]  <<  "\t" << (*max_shared_ptr) << "\t" << min(sketch_size, read_hash_lens[i]) << endl;
-                    outre << ref_keys[max_id] << "\t" << read_keys[i]  <<  "\t" << max_shared << "\t" << sketch_size << (depth_filter ? "FAIL:DEPTH" : "") << "\t" << (match_filter ? "FAIL:MATCHES" : "") << "\t" << (diff_filter ? "" : "FAIL:DIFF") << endl;
-                cout << outre.str();
-                outre.str("");
-                delete [] mins;
-            }
-        }
-        else if (!doReadDepth && stream_files){
-            KSEQ_Reader ksq;
-            int bufsz = 1000;
-            ksq.open(read_files[0]);
-            ksq.buffer_size(bufsz);
-            int l = 0;
-            while (l == 0){
-                ksequence_t* kt;
-                int rnum = 0;
-                l = ksq.get_next_buffer(kt, rnum);
-                #pragma omp for
-                for (int i = 0; i < rnum; ++i){
-                    hash_t* h;
-                    int hashnum;
-                    hash_t* mins;
-                    int minnum;
-                    calc_hashes(rseqs[i], read_lens[i], kmer, h, hashnum);
-                    minhashes(h, hashnum, sketch_size, mins, minnum);
-                }
-            }
-        }
-        else{
+    // Precomputed read sketches come last and are classified as they are.
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < pre_read_keys.size(); ++i){
+        arena_scope_t scope(thread_arena());
+        BottomSketcher sk(sketch_size, thread_arena(), max_hash, sketch_scheme);
+        sk.add(pre_read_mins[i], pre_read_min_lens[i]);
+        classify_and_write(sk, pre_read_keys[i], pre_read_files[pre_read_file_ids[i]], num_single + num_pairs + i);
+    }
+    writer.close();
 
+    delete ref_matrix;
+    for (int i = num_db_refs; i < ref_locs.size(); ++i){
+        delete [] ref_locs[i];
+    }
+    for (int i = 0; i < pre_read_mins.size(); ++i){
+        if (pre_read_owned[i]){
+            delete [] pre_read_mins[i];
         }
     }
-    // Take in a quartet of lines from STDIN (FASTQ format??)
-    // or perhaps just individual read sequences and names (or give them names dynamically
-    // hash them, possibly with kmer depth filtering,
-    // create a sketch, then classify and report the classification.
-    //
-    // Thanks heavens for https://biowize.wordpress.com/2013/03/05/using-kseq-h-with-stdin/
-    
-    delete [] rseqs;
-    delete [] ref_hashes;
-    delete [] ref_minhashes;
+    for (auto db : sketch_dbs){
+        delete db;
+    }
 return 0;
 
 
@@ -996,6 +1510,8 @@ return 0;
 int main_filter(int argc, char** argv){
     vector<char*> ref_files;
     vector<char*> read_files;
+    vector<char*> r1_files;
+    vector<char*> r2_files;
     vector<char*> pre_read_files;
     vector<char*> pre_ref_files;
 
@@ -1005,7 +1521,7 @@ int main_filter(int argc, char** argv){
     int threads = 1;
     int min_kmer_occ = -1;
     int min_matches = -1;
-    int min_diff = 0;
+    int min_diff = -1;
     int max_samples = 100000;
 
     string read_kmer_map_file = "";
@@ -1020,9 +1536,15 @@ int main_filter(int argc, char** argv){
     bool streamify_me_capn = false;
     bool output_reads = false;
 
+    uint64_t ref_mem_mb = 1024;
+    uint64_t read_batch_bytes = 1 << 26;
+    bool in_order = false;
+    hash_scheme_t scheme;
+    uint64_t scale = 0;
+    sketch_scheme_t sketch_scheme = SKETCH_BOTTOM;
+
     // TODO still need:
     // prehashed depth map for reads/ref
-    // prehashed reads / refs
     //
 
     int c;
@@ -1052,16 +1574,53 @@ int main_filter(int argc, char** argv){
             {"read-kmer-map-file", required_argument, 0, 'p'},
             {"ref-kmer-map-file", required_argument, 0, 'q'},
             {"in-stream", no_argument, 0, 'i'},
+            {"ref-mem", required_argument, 0, 'B'},
+            {"in-order", no_argument, 0, 'O'},
+            {"r1", required_argument, 0, '1'},
+            {"r2", required_argument, 0, '2'},
+            {"hash", required_argument, 0, 'H'},
+            {"scaled", required_argument, 0, 'x'},
+            {"sketch-scheme", required_argument, 0, 'e'},
             {0,0,0,0}
         };
 
         int option_index = 0;
-        c = getopt_long(argc, argv, "hdk:f:r:s:S:t:M:N:I:R:F:p:q:iD:", long_options, &option_index);
+        c = getopt_long(argc, argv, "hdOk:f:r:s:S:t:M:N:I:R:F:p:q:iD:B:1:2:H:x:e:", long_options, &option_index);
         if (c == -1){
             break;
         }
 
         switch (c){
+            case 'B':
+                ref_mem_mb = atoi(optarg);
+                break;
+            case 'O':
+                in_order = true;
+                break;
+            case '1':
+                r1_files.push_back(optarg);
+                break;
+            case '2':
+                r2_files.push_back(optarg);
+                break;
+            case 'H':
+                if (!parse_hash_fn(optarg, scheme.fn)){
+                    cerr << "Unknown hash function " << optarg << "; use murmur or rolling." << endl;
+                    exit(1);
+                }
+                break;
+            case 'x':
+                if (!parse_scale(optarg, scale)){
+                    cerr << "-x takes a whole number of at least 1, not " << optarg << "." << endl;
+                    exit(1);
+                }
+                break;
+            case 'e':
+                if (!parse_sketch_scheme(optarg, sketch_scheme)){
+                    cerr << "Unknown sketch scheme " << optarg << "; use bottom or oph." << endl;
+                    exit(1);
+                }
+                break;
             case 'F':
                 pre_read_files.push_back(optarg);
                 break;
@@ -1128,7 +1687,8 @@ int main_filter(int argc, char** argv){
         sketch_size = 1000;
     }
 
-    if (kmer.size() == 0){
+    // Precomputed sketches (-R / -F) carry their own kmer sizes
+    if (kmer.size() == 0 && pre_ref_files.empty() && pre_read_files.empty()){
         cerr << "No kmer size(s) provided. Will use a default kmer size of 16." << endl;
         kmer.push_back(16);
     }
@@ -1141,183 +1701,207 @@ int main_filter(int argc, char** argv){
     }
     if (!ref_kmer_map_file.empty()){
 
-    }
-    //read in prehashed sequences
-    if (!pre_read_files.empty()){
-
-    }
-    if (!pre_ref_files.empty()){
-
     }
 
     vector<string> ref_keys;
-    vector<char*> ref_seqs;
-    vector<int> ref_lens;
+    vector<hash_t*> ref_mins;
+    vector<int> ref_min_lens;
+
+    check_scaled(scale, pre_ref_files, pre_read_files);
+    check_one_perm(0, sketch_scheme, scale, false, pre_ref_files, pre_read_files);
+
+    // Precomputed sketches (-R / -F) are used as they are, and everything
+    // hashed here must pick canonical kmers the same way they did.
+    bool canonical_set = false;
+    vector<SketchDB*> sketch_dbs;
+    int num_db_refs = load_precomputed_sketches(pre_ref_files, kmer, sketch_size, scheme, canonical_set,
+            ref_keys, ref_mins, ref_min_lens, sketch_dbs);
+    vector<string> pre_read_keys;
+    vector<hash_t*> pre_read_mins;
+    vector<int> pre_read_min_lens;
+    int num_db_reads = load_precomputed_sketches(pre_read_files, kmer, sketch_size, scheme, canonical_set,
+            pre_read_keys, pre_read_mins, pre_read_min_lens, sketch_dbs);
+    check_kmer_sizes(scheme, kmer);
+    hash_t max_hash = scaled_max_hash(scale);
 
     vector<string> read_keys;
     vector<char*> read_seqs;
-    vector<string> read_quals;
+    vector<char*> read_quals;
     vector<int> read_lens;
 
+    HASHTCounter read_hash_counter(10000000);
+    HASHTCounter ref_hash_counter(10000000);
 
     //read in new refs/reads, hash them and keep their sketches.
 
+    // References are sketched as they are read; only the sketches are kept.
     if (!ref_files.empty()){
-        parse_fastas(ref_files, ref_keys, ref_seqs, ref_lens);
+        sketch_reference_files(ref_files, kmer, sketch_size, ref_mem_mb << 20,
+                ref_keys, ref_mins, ref_min_lens,
+                max_samples < 100000 ? &ref_hash_counter : NULL, max_samples, true, scheme, max_hash, NULL, sketch_scheme);
+    }
+
+    // References are compared from one matrix: the database's own mapping if
+    // they all came from a single one, otherwise a copy (see main_stream).
+    SketchMatrix* ref_matrix;
+    const char* ref_db = NULL;
+    if (ref_files.empty() && pre_ref_files.size() == 1 && num_db_refs > 0 && num_db_refs == ref_keys.size()){
+        ref_matrix = new SketchMatrix(*sketch_dbs[0], sketch_size);
+        // a saved index covers whole sketches, so not a smaller -s
+        ref_db = sketch_size == sketch_dbs[0]->sketch_size() ? pre_ref_files[0] : NULL;
+    }
+    else{
+        ref_matrix = new SketchMatrix(ref_keys, ref_mins.data(), ref_min_lens.data());
+    }
+    for (int i = num_db_refs; i < ref_mins.size(); ++i){
+        delete [] ref_mins[i];
     }
+    vector<hash_t*>().swap(ref_mins);
+    vector<string>().swap(ref_keys);
+
+    // Bottom sketches are classified through an index of the reference sketches.
+    RefIndex ref_index;
+    if (sketch_scheme == SKETCH_BOTTOM){
+        reference_index(ref_index, *ref_matrix, ref_db, kmer, scheme.fn, sketch_size);
+    }
+
     if (!read_files.empty()){
         parse_fastas(read_files, read_keys, read_seqs, read_lens, read_quals);
     }
 
-    vector<hash_t*> ref_hashes(ref_keys.size());
-    vector<int> ref_hash_lens(ref_keys.size());
-
     vector<hash_t*> read_hashes(read_keys.size());
     vector<int> read_hash_lens(read_keys.size());
 
-    vector<hash_t*> ref_mins(ref_keys.size());
-    int* ref_min_lens = new int [ref_keys.size()];
-    int* ref_min_starts = new int [ref_keys.size()];
-
     vector<hash_t*> read_mins(read_keys.size());
     int* read_min_starts = new int [ read_keys.size() ];
     int* read_min_lens = new int [read_keys.size() ];
 
 
-    HASHTCounter read_hash_counter(10000000);
-    HASHTCounter ref_hash_counter(10000000);
-
-    vector<vector<string> > results(threads);
-
-    if (!ref_files.empty()){
-        hash_sequences(ref_keys, ref_seqs, ref_lens, ref_hashes, ref_hash_lens, kmer, read_hash_counter, ref_hash_counter, false, doReferenceDepth);
+    // Without a depth filter, reads are sketched straight from their sequence
+    // below; with one, every read must be counted before any is sketched.
+    if (!read_files.empty() && doReadDepth){
+        hash_sequences(read_keys, read_seqs, read_lens, read_hashes, read_hash_lens, kmer, read_hash_counter, ref_hash_counter, doReadDepth, false, scheme);
     }
-
-
-    if (!read_files.empty()){
-        hash_sequences(read_keys, read_seqs, read_lens, read_hashes, read_hash_lens, kmer, read_hash_counter, ref_hash_counter, doReadDepth, false);
+    if (doReadDepth && !r1_files.empty()){
+        vector<char*> mate_files(r1_files);
+        mate_files.insert(mate_files.end(), r2_files.begin(), r2_files.end());
+        MultiFileBatchReader counter_reader(mate_files, read_batch_bytes);
+        counter_reader.use_scheme(scheme);
+        pipelined_for_each(counter_reader,
+                [&](seq_batch_t& b){},
+                [&](seq_batch_t& b, int i){
+                    b.each_hash(i, kmer, [&](const hash_t* h, int n){
+                            for (int j = 0; j < n; ++j){
+                                read_hash_counter.increment(h[j]);
+                            }
+                            });
+                });
     }
 
-    //Time to calculate mins for references!
-#pragma omp parallel
-    {
-        //int tid = omp_get_thread_num();
-#pragma omp for
-        for (int i = 0; i < ref_keys.size(); i++){
-            ref_min_starts[i] = 0;
-            ref_min_lens[i] = 0;
-            ref_mins[i] = new hash_t[ sketch_size ];
-            std::sort(ref_hashes[i], ref_hashes[i] + ref_hash_lens[i]);
-            if (max_samples < 100000){
-                for (int j = 0; j < ref_hash_lens[i], ref_min_lens[i] < sketch_size; ++j){
-                    //if (ref_sketch_lens[i] >= sketch_size){
-                    //    break;
-                    //}
-                    hash_t curr = *(ref_hashes[i] + j);
-                    //cerr << ref_hash_counter.get(curr) << endl;
-                    if (curr != 0 && ref_hash_counter.get(curr) <= max_samples){
-                        ref_mins[i][ref_min_lens[i]] = curr;
-                        //ref_mins[i][ref_min_lens[i]] = ref_hashes[i][j];
-                        ++ref_min_lens[i];
-                        if (ref_min_lens[i] == sketch_size){
-                            break;
-                        }
-                    }
-                    else{
-                        continue;
-                    }
-                }
-
-            }
-            else{
-                while (ref_hashes[i][ref_min_starts[i]] == 0 && ref_min_starts[i] < ref_hash_lens[i]){
-                    ++ref_min_starts[i];
-                }
-                for (int j = ref_min_starts[i]; j < ref_hash_lens[i], ref_min_lens[i] < sketch_size; ++j){
-                    *(ref_mins[i] +ref_min_lens[i]) = *(ref_hashes[i] + j);
-                    ++ref_min_lens[i];
-                }
+    // Reads from -f are numbered first, then those from STDIN, then pairs,
+    // then precomputed read sketches.
+    ResultWriter writer(stdout, in_order);
 
+    // Add a block of a read's hashes to its sketch, dropping those below the kmer depth cutoff.
+    auto sketch_block = [&](BottomSketcher& sk, const hash_t* h, int n){
+        for (int j = 0; j < n; ++j){
+            if (sk.wants(h[j]) && (!doReadDepth || read_hash_counter.get(h[j]) >= min_kmer_occ)){
+                sk.push(h[j]);
             }
-            ref_min_starts[i] = 0;
-
-            delete [] ref_hashes[i];
+        }
+    };
 
+    // Classify a read's sketch: through ref_index for bottom sketches, slot by
+    // slot otherwise, starting from this thread's last best match.
+    auto classify_sketch = [&](hash_t* mins, int sketch_len) -> tuple<string, int, int, bool>{
+        if (sketch_scheme == SKETCH_BOTTOM){
+            arena_scope_t scope(thread_arena());
+            int* shared = thread_arena().alloc<int>(std::max(ref_matrix->size(), 1));
+            return classify_and_count_diff_filter(*ref_matrix, ref_index, mins, sketch_len, min_diff, shared);
         }
+        static thread_local int last_best = 0;
+        return classify_and_count_diff_filter(*ref_matrix, mins, sketch_len, sketch_size, min_diff, sketch_scheme, &last_best);
+    };
 
+    // Reads without sequence to write out (STDIN, -F) are reported as classifications.
+    // filled is the sketcher's filled(), for the depth test.
+    auto write_sample_result = [&](const string& key, hash_t* mins, int sketch_len, int filled, uint64_t index){
+        tuple<string, int, int, bool> result;
+        result = classify_sketch(mins, sketch_len);
+
+        bool depth_filter = filled <= 0;
+        bool match_filter = std::get<1>(result) < min_matches;
+
+        out_buf_t outre;
+        outre.append("Sample: ");
+        outre.append(key);
+        outre.append("\tResult: ");
+        outre.append(std::get<0>(result));
+        outre.append('\t');
+        outre.append_int(std::get<1>(result));
+        outre.append('\t');
+        outre.append_int(std::get<2>(result));
+        outre.append('\t');
+        outre.append(depth_filter ? "FAIL:DEPTH" : "");
+        outre.append('\t');
+        outre.append(match_filter ? "FAIL:MATCHES" : "");
+        outre.append('\t');
+        outre.append(std::get<3>(result) ? "" : "FAIL:DIFF");
+        outre.append('\n');
+        writer.write(index, outre);
+    };
+
+#pragma omp parallel
+    {
         // Classify existing reads
         // conveniently, read_keys.size() will be zero if there are no reads.
-#pragma omp for
+#pragma omp for schedule(dynamic, 64)
         for (int i = 0; i < read_keys.size(); i++){
-            stringstream outre;
-            read_mins[i] = new hash_t[ sketch_size ];
-            read_min_lens[i] = 0;
-            read_min_starts[i] = 0;
-            std::sort(read_hashes[i], read_hashes[i] + read_hash_lens[i]);
+            out_buf_t outre;
+            arena_scope_t scope(thread_arena());
+            BottomSketcher sk(sketch_size, thread_arena(), max_hash, sketch_scheme);
             if (doReadDepth){
-                for (int j = 0; j < read_hash_lens[i]; ++j){
-
-                    if (read_hashes[i][j] != 0 && read_hash_counter.get(read_hashes[i][j]) >= min_kmer_occ){
-                        read_mins[i][read_min_lens[i]] = *(read_hashes[i] + j);
-
-                        ++(read_min_lens[i]);
-                        if (read_min_lens[i] == sketch_size){
-                            break;
-                        }
-                    }
-                    else{
-                        continue;
-                    }
-                }
+                sketch_block(sk, read_hashes[i], read_hash_lens[i]);
+                delete [] read_hashes[i];
             }
             else{
-                while (read_hashes[i][ read_min_starts[i] ] == 0 && read_min_starts[i] < read_hash_lens[i]){
-                    ++read_min_starts[i];
-                }
-                for (int j = read_min_starts[i]; j < read_hash_lens[i]; ++j){
-                    read_mins[i][read_min_lens[i]] = *(read_hashes[i] + j);
-                    ++(read_min_lens[i]);
-                    if (read_min_lens[i] == sketch_size){
-                        break;
-                    }
-                }
+                for_each_hash(buffer_view(read_seqs[i], read_lens[i]), kmer, scheme,
+                        [&](const hash_t* h, int n){ sketch_block(sk, h, n); });
             }
+            // the sketch lives in the thread arena until this read is done
+            sk.finish(read_mins[i], read_min_lens[i]);
             read_min_starts[i] = 0;
-            delete [] read_hashes[i];
 
             tuple<string, int, int, bool> result;
-            result = classify_and_count_diff_filter(ref_keys, ref_mins, read_mins[i], ref_min_starts, read_min_starts[i], ref_min_lens, read_min_lens[i], sketch_size, min_diff);
+            result = classify_sketch(read_mins[i], read_min_lens[i]);
 
 
-            bool depth_filter = read_min_lens[i] <= 0; 
+            bool depth_filter = sk.filled() <= 0;
             bool match_filter = std::get<1>(result) < min_matches;
 
             //cerr << read_keys[i] << " " << read_seqs[i] << endl
             //    << read_quals[i] << endl;
 
+            // written as read, FASTQ if it had qualities (as append_record does)
             if (!depth_filter && !match_filter && std::get<3>(result)){
-                outre << ">" << string(read_keys[i]) << endl
-                    << string(read_seqs[i], read_lens[i]) << endl
-                    << "+" << endl
-                    << string(read_quals[i]) << endl;
-
-                //results[tid].push_back(outre.str());
-#pragma omp critical
-                {
-                    cout << outre.str();
-                    outre.str("");
+                bool fastq = read_quals[i] != NULL;
+                outre.append(fastq ? '@' : '>');
+                outre.append(read_keys[i]);
+                outre.append('\n');
+                outre.append(read_seqs[i], read_lens[i]);
+                outre.append('\n');
+                if (fastq){
+                    outre.append("+\n");
+                    outre.append(read_quals[i], read_lens[i]);
+                    outre.append('\n');
                 }
             }
-            delete [] read_mins[i];
+            // failing reads still check in (with nothing) so in-order output can move past them
+            writer.write(i, outre);
 
 
         }
     }
-    /**for (int i = 0; i < results.size(); ++i){
-      for (int j = 0; j < results[i].size(); ++j){
-      cout << results[i][j];
-      }
-      }**/
 
     // Take in a quartet of lines from STDIN (FASTQ format??)
     // or perhaps just individual read sequences and names (or give them names dynamically
@@ -1326,100 +1910,79 @@ int main_filter(int argc, char** argv){
     //
     // Thanks heavens for https://biowize.wordpress.com/2013/03/05/using-kseq-h-with-stdin/
 
-        if (streamify_me_capn){
-            #pragma omp parallel
-            {
-#pragma omp single nowait
-            {
-                FILE *instream = NULL;
-                instream = stdin;
-
-                gzFile fp = gzdopen(fileno(instream), "r");
-                kseq_t *seq = kseq_init(fp);
-
-
-                while (kseq_read(seq) >= 0){
-
-                    to_upper(seq->seq.s, seq->seq.l);
-
-                    string name = string(seq->name.s);
-                    int len = seq->seq.l;
-
-                    // hash me
-
-//#pragma omp task_async
-#pragma omp task
-                    {
-                        vector<hash_t> r = calc_hashes(seq->seq.s, len, kmer);
-                        hash_t* hashes = &(*r.begin());
-                        int hashlen = r.size();
-
-                        stringstream outre;
-
-                        std::sort(hashes, hashes + hashlen);
-                        // and then just sketch me
-                        // TODO need to handle some read_depth
-                        int sketch_start = 0;
-                        int sketch_len = 0;
-                        hash_t* mins = new hash_t[sketch_size];
-                        if (min_kmer_occ > 0){
-                            for (int i = 0; i < hashlen; ++i){
-                                hash_t curr = *(hashes + i);
-                                if (read_hash_counter.get(curr) >= min_kmer_occ && curr != 0){
-                                    mins[sketch_len] = curr;
-                                    ++sketch_len;
-                                }
-                                if (sketch_len == sketch_size){
-                                    break;
-                                }
-                            }
-                        }
-                        else{
-                            while (hashes[sketch_start] == 0 && sketch_start < hashlen){
-                                ++sketch_start;
-                            }
-                            for (int i = sketch_start; i < hashlen; ++i){
-                                mins[sketch_len++] = *(hashes + i);
-                                if (sketch_len == sketch_size){
-                                    break;
-                                }
-                            }
-                        }
-                        sketch_start = 0;
-                        // so I can get my
-                        // classification
-                        tuple<string, int, int, bool> result;
-                        result = classify_and_count_diff_filter(ref_keys, ref_mins, mins, ref_min_starts, sketch_start, ref_min_lens, sketch_len, sketch_size, min_diff);
+    uint64_t num_stdin = 0;
+    if (streamify_me_capn){
+        vector<char*> stdin_files = {(char*) "-"};
+        BatchReader stdin_reader(stdin_files, read_batch_bytes);
+        stdin_reader.use_scheme(scheme);
+        num_stdin = pipelined_for_each(stdin_reader,
+                [&](seq_batch_t& b){},
+                [&](seq_batch_t& b, int i){
+                    // and then just sketch me
+                    BottomSketcher sk(sketch_size, thread_arena(), max_hash, sketch_scheme);
+                    b.each_hash(i, kmer, [&](const hash_t* h, int n){ sketch_block(sk, h, n); });
+                    hash_t* mins;
+                    int sketch_len;
+                    sk.finish(mins, sketch_len);
+                    // so I can get my
+                    // classification
+                    write_sample_result(b.keys[i], mins, sketch_len, sk.filled(), read_keys.size() + b.start + i);
+                });
+    }
 
-                        bool depth_filter = sketch_len <= 0; 
-                        bool match_filter = std::get<1>(result) < min_matches;
+    // Read pairs are sketched from the kmers of both mates, classified once,
+    // and written out together if the pair passes.
+    uint64_t num_pairs = 0;
+    if (!r1_files.empty()){
+        PairedBatchReader pair_reader(r1_files, r2_files, read_batch_bytes);
+        pair_reader.keep_quals(true);
+        pair_reader.use_scheme(scheme);
+        num_pairs = pipelined_for_each(pair_reader,
+                [&](pair_batch_t& b){},
+                [&](pair_batch_t& b, int i){
+                    BottomSketcher sk(sketch_size, thread_arena(), max_hash, sketch_scheme);
+                    pair_each_hash(b, i, kmer, [&](const hash_t* h, int n){ sketch_block(sk, h, n); });
+                    hash_t* mins;
+                    int sketch_len;
+                    sk.finish(mins, sketch_len);
 
-                        outre  << "Sample: " << name << "\t" << "Result: " << 
-                            std::get<0>(result) << "\t" << std::get<1>(result) << "\t" << std::get<2>(result) << "\t" <<
-                            (depth_filter ? "FAIL:DEPTH" : "") << "\t" << (match_filter ? "FAIL:MATCHES" : "") << "\t" << (std::get<3>(result) ? "" : "FAIL:DIFF") << endl;
+                    tuple<string, int, int, bool> result;
+                    result = classify_sketch(mins, sketch_len);
 
-                        //#pragma omp critical
-                        cout << outre.str();
-                        outre.str("");
+                    bool depth_filter = sk.filled() <= 0;
+                    bool match_filter = std::get<1>(result) < min_matches;
 
-                        delete [] hashes;
-                        delete [] mins;
+                    out_buf_t outre;
+                    if (!depth_filter && !match_filter && std::get<3>(result)){
+                        append_record(outre, b.r1, i);
+                        append_record(outre, b.r2, i);
                     }
-                }
+                    writer.write(read_keys.size() + num_stdin + b.start + i, outre);
+                });
+    }
 
-                kseq_destroy(seq);
-                gzclose(fp);
-            }
-        }
-        }
+    #pragma omp parallel for schedule(dynamic, 64)
+    for (int i = 0; i < pre_read_keys.size(); ++i){
+        write_sample_result(pre_read_keys[i], pre_read_mins[i], pre_read_min_lens[i], pre_read_min_lens[i],
+                read_keys.size() + num_stdin + num_pairs + i);
+    }
+    writer.close();
 
 
-        delete [] ref_min_lens;
         delete [] read_min_lens;
         delete [] read_min_starts;
-        delete [] ref_min_starts;
-
+        for (int i = 0; i < read_quals.size(); ++i){
+            delete [] read_quals[i];
+        }
+        delete ref_matrix;
+        for (int i = num_db_reads; i < pre_read_mins.size(); ++i){
+            delete [] pre_read_mins[i];
+        }
+        for (auto db : sketch_dbs){
+            delete db;
+        }
 
+        return 0;
 
     }
 
@@ -1466,6 +2029,7 @@ int main_filter(int argc, char** argv){
 
         bool show_depth = false;
         bool output_vcf = true;
+        hash_scheme_t scheme;
 
         int c;
         int optind = 2;
@@ -1486,16 +2050,23 @@ int main_filter(int argc, char** argv){
                 {"threads", required_argument, 0, 't'},
                 {"show-depth", required_argument, 0, 'd'},
                 {"window-len", required_argument, 0, 'w'},
+                {"hash", required_argument, 0, 'H'},
                 {0,0,0,0}
             };
 
             int option_index = 0;
-            c = getopt_long(argc, argv, "hdk:f:r:s:t:w:", long_options, &option_index);
+            c = getopt_long(argc, argv, "hdk:f:r:s:t:w:H:", long_options, &option_index);
             if (c == -1){
                 break;
             }
 
             switch (c){
+                case 'H':
+                    if (!parse_hash_fn(optarg, scheme.fn)){
+                        cerr << "Unknown hash function " << optarg << "; use murmur or rolling." << endl;
+                        exit(1);
+                    }
+                    break;
                 case 't':
                     threads = atoi(optarg);
                     break;
@@ -1550,6 +2121,7 @@ int main_filter(int argc, char** argv){
             cerr << "Please choose a single kmer size." << endl;
             exit(1);
         }
+        check_kmer_sizes(scheme, kmer);
 
         omp_set_num_threads(threads);
 
@@ -1608,12 +2180,12 @@ int main_filter(int argc, char** argv){
            #pragma omp for
             for (int i = 0; i < num_refs; ++i){
                 to_upper(ref_seqs[i], ref_lens[i]);
-                calc_hashes(ref_seqs[i], ref_lens[i], kmer, ref_hashes[i], ref_hash_lens[i], ref_htc);
+                calc_hashes(ref_seqs[i], ref_lens[i], kmer, ref_hashes[i], ref_hash_lens[i], ref_htc, scheme);
             } 
             #pragma omp for
             for (int i = 0; i < num_reads; ++i){
                 to_upper(read_seqs[i], read_lens[i]);
-                calc_hashes(read_seqs[i], read_lens[i], kmer, read_hashes[i], read_hash_lens[i], read_htc);
+                calc_hashes(read_seqs[i], read_lens[i], kmer, read_hashes[i], read_hash_lens[i], read_htc, scheme);
                 #pragma omp critical
                 {
                 for (int j = 0; j < read_hash_lens[i]; ++j){
@@ -1808,7 +2380,7 @@ int main_filter(int argc, char** argv){
                             char orig = alt[alt_pos];
                             for (auto x : rotate_snps(orig)){
                                 alt[alt_pos] = x;
-                                int alt_depth = read_hash_to_depth[calc_hash(alt)];
+                                int alt_depth = read_hash_to_depth[hash_kmer(alt, scheme)];
                                 max_rescue = max_rescue > alt_depth ? max_rescue : alt_depth;
 
                                 if ( !show_depth && alt_depth >= .1 * avg_d & alt_depth > depth){
@@ -1849,7 +2421,7 @@ int main_filter(int argc, char** argv){
                                 stringstream mod;
                                 char orig = d_alt[alt_pos];
                                 mod << d_alt.substr(0, alt_pos) << d_alt.substr(alt_pos + 1, d_alt.length() - alt_pos);
-                                int alt_depth = read_hash_to_depth[calc_hash(mod.str())];
+                                int alt_depth = read_hash_to_depth[hash_kmer(mod.str(), scheme)];
                                 if (output_vcf && alt_depth > 0.9 * avg_d){
                                     int pos = j + alt_pos + 1;
                                     stringstream sstream;
@@ -1949,7 +2521,16 @@ int main_filter(int argc, char** argv){
         bool traditional_minhash = false;
         bool output_kmers = false;
         bool output_counts = false;
+        bool in_order = false;
         string outname = "";
+        string binary_out = "";
+        string json_out = "";
+        bool positions = false;
+        bool write_index = false;
+        hash_scheme_t scheme;
+
+        // long-only options
+        const int OPT_INDEX = 256;
 
         int c;
         int optind = 2;
@@ -1975,17 +2556,29 @@ int main_filter(int argc, char** argv){
                 {"min-kmer-occurence", required_argument, 0, 'M'},
                 {"max-samples", required_argument, 0, 'I'},
                 {"out-prefix", required_argument, 0, 'o'},
+                {"in-order", no_argument, 0, 'O'},
+                {"binary", required_argument, 0, 'b'},
+                {"json", required_argument, 0, 'j'},
+                {"hash", required_argument, 0, 'H'},
+                {"positions", no_argument, 0, 'P'},
+                {"index", no_argument, 0, OPT_INDEX},
                 {0,0,0,0}
             };
 
             int option_index = 0;
 
-            c = getopt_long(argc, argv, "ThcwKk:f:r:s:t:mM:I:o:", long_options, &option_index);
+            c = getopt_long(argc, argv, "ThcwKOPk:f:r:s:t:mM:I:o:b:j:H:", long_options, &option_index);
             if (c == -1){
                 break;
             }
 
             switch (c){
+                case 'H':
+                    if (!parse_hash_fn(optarg, scheme.fn)){
+                        cerr << "Unknown hash function " << optarg << "; use murmur or rolling." << endl;
+                        exit(1);
+                    }
+                    break;
                 case 'T':
                     traditional_minhash = true;
                     break;
@@ -2029,6 +2622,21 @@ int main_filter(int argc, char** argv){
                 case 'o':
                     outname = string(optarg);
                     break;
+                case 'O':
+                    in_order = true;
+                    break;
+                case 'b':
+                    binary_out = string(optarg);
+                    break;
+                case 'j':
+                    json_out = string(optarg);
+                    break;
+                case 'P':
+                    positions = true;
+                    break;
+                case OPT_INDEX:
+                    write_index = true;
+                    break;
                 default:
                     print_help(argv);
                     abort();
@@ -2043,13 +2651,56 @@ int main_filter(int argc, char** argv){
             cerr << "Using default kmer size of 16." << endl;
             kmer.push_back(16);
         }
+        check_kmer_sizes(scheme, kmer);
+        if (positions && binary_out.empty()){
+            cerr << "Positions (-P) are only stored in sketch databases; pass -b <FILE>." << endl;
+            exit(1);
+        }
+        if (write_index && (binary_out.empty() || binary_out == "-")){
+            cerr << "A reference index (--index) is written beside a sketch database file; pass -b <FILE>." << endl;
+            exit(1);
+        }
 
         bool use_freqs = (doReferenceDepth || doReadDepth);
 
         omp_set_num_threads(threads);
 
+        // Sketch each input sequence and write them all as one sketch database
+        // and/or one JSON file.
+        if (!binary_out.empty() || !json_out.empty()){
+            if (sketch_size <= 0){
+                cerr << "No sketch size provided. Will use a default sketch size of 1000." << endl;
+                sketch_size = 1000;
+            }
+            vector<string> keys;
+            vector<hash_t*> mins;
+            vector<int> min_lens;
+            vector<const uint64_t*> locs;
+            HASHTCounter ref_counter(10000000);
+            sketch_reference_files(input_files, kmer, sketch_size, (uint64_t) 1 << 30,
+                    keys, mins, min_lens,
+                    doReferenceDepth ? &ref_counter : NULL, max_samples, true, scheme,
+                    0, positions ? &locs : NULL);
+            if (!binary_out.empty()){
+                rkmh_binary_output(keys, mins, min_lens, kmer, sketch_size, binary_out, scheme.fn,
+                        positions ? &locs : NULL, write_index);
+            }
+            if (!json_out.empty()){
+                rkmh_json_output(keys, mins, min_lens, kmer, sketch_size, json_out, scheme);
+            }
+            for (auto x : mins){
+                delete [] x;
+            }
+            for (auto x : locs){
+                delete [] x;
+            }
+            return 0;
+        }
+
         int bufsz = 1000;
 
+        ResultWriter writer(stdout, in_order);
+
         // In parallel
         // read in a chunk of fastq reads
         // hash those reads
@@ -2069,17 +2720,30 @@ int main_filter(int argc, char** argv){
                     int l = 0;
                     ksequence_t* kt;
                     int num;
+                    uint64_t base = 0;
                     while (l == 0){
                         l = ksr.get_next_buffer(kt, num);
                         //#pragma omp for
                         for (int i = 0; i < num; ++i){
-                            #pragma omp task 
+                            #pragma omp task firstprivate(base)
                             {
-                                print_kmers(kt[i].sequence, kt[i].length, kmer[0], kt[i].name); 
+                                out_buf_t outre;
+                                outre.append(kt[i].name);
+                                outre.append('\t');
+                                for (int j = 0; j + kmer[0] <= kt[i].length; ++j){
+                                    if (j > 0){
+                                        outre.append(' ');
+                                    }
+                                    outre.append(kt[i].sequence + j, kmer[0]);
+                                }
+                                outre.append('\n');
+                                writer.write(base + i, outre);
                             }
                         }
+                        // the next buffer reuses this one's records
+                        #pragma omp taskwait
+                        base += num;
                     }
-                    #pragma omp taskwait
                 }
                 else if (!use_freqs){
                     char* f = input_files[0];
@@ -2090,27 +2754,40 @@ int main_filter(int argc, char** argv){
                     int l = 0;
                     ksequence_t* kt;
                     int num;
+                    uint64_t base = 0;
                     while (l == 0){
                         l = ksr.get_next_buffer(kt, num);
                         //#pragma omp for
                         for (int i = 0; i < num; ++i){
-                            #pragma omp task 
+                            #pragma omp task firstprivate(base)
                             {
                                 hash_t* h;
                                 int num;
-                                calc_hashes(kt[i].sequence, kt[i].length, kmer, h, num);
-                                print_hashes(h, num, kt[i].name);
+                                calc_hashes(kt[i].sequence, kt[i].length, kmer, h, num, scheme);
+                                out_buf_t outre;
+                                outre.append(kt[i].name);
+                                outre.append('\t');
+                                for (int j = 0; j < num; ++j){
+                                    if (j > 0){
+                                        outre.append(' ');
+                                    }
+                                    outre.append_uint(h[j]);
+                                }
+                                outre.append('\n');
+                                writer.write(base + i, outre);
                                 delete [] h;
                             }
                         }
+                        #pragma omp taskwait
+                        base += num;
                     }
-                    #pragma omp taskwait
                 }
                 else{
                 
                 }
             }
         }
+        writer.close();
 
         return 0;
     }
@@ -2135,6 +2812,7 @@ int main_filter(int argc, char** argv){
 
         int threads = 1;
         vector<int> kmer;
+        bool in_order = false;
 
         int c;
         int optind = 2;
@@ -2152,12 +2830,13 @@ int main_filter(int argc, char** argv){
                 {"reference", required_argument, 0, 'r'},
                 {"threads", required_argument, 0, 't'},
                 {"kmer", required_argument, 0, 'k'},
+                {"in-order", no_argument, 0, 'O'},
                 {0,0,0,0}
             };
 
             int option_index = 0;
 
-            c = getopt_long(argc, argv, "k:f:r:h", long_options, &option_index);
+            c = getopt_long(argc, argv, "k:f:r:t:hO", long_options, &option_index);
             if (c == -1){
                 break;
             }
@@ -2175,6 +2854,9 @@ int main_filter(int argc, char** argv){
                 case 'r':
                     ref_files.push_back(optarg);
                     break;
+                case 'O':
+                    in_order = true;
+                    break;
                 case '?':
                 case 'h':
                     //print_help(argv);
@@ -2202,55 +2884,39 @@ int main_filter(int argc, char** argv){
         }
 
 
-#pragma omp parallel
-        {
-#pragma omp single
-            {
-                for (auto f : read_files){
-                    KSEQ_Reader kh;
-                    kh.open(f);
-                    kh.buffer_size(bufsz);
-                    ksequence_t* buf;
-                    int buflen;
-                    int l = 0;
-                    stringstream seqstr;
-                    while (l == 0){
-                        l= kh.get_next_buffer(buf, buflen);
-                        // Iterate over a buffer of sequences
-                        for (int i = 0; i < buflen; ++i){
-#pragma omp task shared(buf, buflen, seqstr, refs)
-                            {
-                                vector<char*> foundmers;
-                                seqstr << (buf + i)->name << "\t";
-                                int seqlen = (buf + i)->length;
-                                to_upper((buf + i)->sequence, seqlen);
-
-                                mkmh_kmer_list_t kmers = kmerize((buf + i)->sequence, seqlen, kmer[0]);
-                                if (kmers.length > 0){
-                                    for (int j = 0; j < kmers.length; ++j){
-                                        if (htc.get(kmers.kmers[j] > 0)){
-                                        //if(refs.count(kmers.kmers[j])){
-                                            //seqstr << kmers.kmers[i] << ",";
-                                            foundmers.push_back(kmers.kmers[j]);
-                                        }
-                                    }
-                                    }
-                                    for (int j = 0; j < foundmers.size(); ++j){
-                                        seqstr << foundmers[j];
-                                        if (j < foundmers.size() - 1){
-                                            seqstr << ",";
-                                        }
-                                    }
-                                    seqstr << "\n";
-                                    cout << seqstr.str();
-                                    seqstr.str("");
-                                }
+        omp_set_num_threads(threads);
+        ResultWriter writer(stdout, in_order);
+
+        // Several read files are decoded concurrently (see MultiFileBatchReader).
+        MultiFileBatchReader reader(read_files, 1 << 26, bufsz);
+        pipelined_for_each(reader,
+                [&](seq_batch_t& b){},
+                [&](seq_batch_t& b, int i){
+                    vector<char*> foundmers;
+                    out_buf_t seqstr;
+                    seqstr.append(b.keys[i]);
+                    seqstr.append('\t');
+                    char* seq = (char*) b.get_seq(i, thread_arena());
+
+                    mkmh_kmer_list_t kmers = kmerize(seq, b.lens[i], kmer[0]);
+                    if (kmers.length > 0){
+                        for (int j = 0; j < kmers.length; ++j){
+                            if (htc.get(calc_hash(kmers.kmers[j], kmer[0])) > 0){
+                            //if(refs.count(kmers.kmers[j])){
+                                foundmers.push_back(kmers.kmers[j]);
                             }
                         }
                     }
-
-                }
-            }
+                    for (int j = 0; j < foundmers.size(); ++j){
+                        seqstr.append(foundmers[j], kmer[0]);
+                        if (j < foundmers.size() - 1){
+                            seqstr.append(',');
+                        }
+                    }
+                    seqstr.append('\n');
+                    writer.write(b.start + i, seqstr);
+                });
+        writer.close();
 
             return 0;
         }
@@ -2320,41 +2986,18 @@ int main_filter(int argc, char** argv){
 
             omp_set_num_threads(threads);
             HASHTCounter htc(640000);
-            KSEQ_Reader* kt = new KSEQ_Reader();
-            kt->buffer_size(bz);
-
-#pragma omp parallel shared(kt, htc)
-            {
-#pragma omp single
-                {
-                    for (int fi_ind = 0; fi_ind < read_files.size(); fi_ind++){
-                        int l = 0;
-                        kt->open(read_files[fi_ind]);
-                        while (l == 0){
-                            {
-                                ksequence_t* kst;
-                                int num;
-                                l = kt->get_next_buffer(kst, num);
-                                for (int i = 0; i < num; ++i){
-                                    char* s = (kst + i)->sequence;
-                                    int length = (kst + i)->length;
-#pragma omp task
-                                    {
-                                        vector<hash_t> hashes = calc_hashes((const char*) s, length, kmer);
-                                        for (int h_ind = 0; h_ind < hashes.size(); ++h_ind){
-                                            htc.increment(hashes[h_ind]);
-                                        }
-                                    }
 
+            // Several read files are decoded concurrently (see MultiFileBatchReader).
+            MultiFileBatchReader reader(read_files, 1 << 26, bz);
+            pipelined_for_each(reader,
+                    [&](seq_batch_t& b){},
+                    [&](seq_batch_t& b, int i){
+                        b.each_hash(i, kmer, [&](const hash_t* hashes, int num){
+                                for (int h_ind = 0; h_ind < num; ++h_ind){
+                                    htc.increment(hashes[h_ind]);
                                 }
-
-                            }
-                        }
-                    }
-                }
-            }
-
-            delete kt;
+                                });
+                    });
 
             return 0;
         }
@@ -2376,6 +3019,8 @@ int main_filter(int argc, char** argv){
 
             bool do_read_depth = false;
             bool do_ref_depth = false;
+            bool in_order = false;
+            hash_scheme_t scheme;
             
             int default_kmer_size = 16;
             vector<int> kmer_sizes;
@@ -2401,11 +3046,13 @@ int main_filter(int argc, char** argv){
                     {"min-matches", required_argument, 0, 'N'},
                     {"min-diff", required_argument, 0, 'D'},
                     {"max-samples", required_argument, 0, 'I'},
+                    {"in-order", no_argument, 0, 'O'},
+                    {"hash", required_argument, 0, 'H'},
                     {0,0,0,0}
                 };
 
                 int option_index = 0;
-                c = getopt_long(argc, argv, "hk:f:R:s:t:M:N:D:", long_options, &option_index);
+                c = getopt_long(argc, argv, "hOk:f:R:s:t:M:N:D:H:", long_options, &option_index);
                 if (c == -1){
                     break;
                 }
@@ -2441,6 +3088,15 @@ int main_filter(int argc, char** argv){
                     case 'D':
                         min_diff = atoi(optarg);
                         break;
+                    case 'O':
+                        in_order = true;
+                        break;
+                    case 'H':
+                        if (!parse_hash_fn(optarg, scheme.fn)){
+                            cerr << "Unknown hash function " << optarg << "; use murmur or rolling." << endl;
+                            exit(1);
+                        }
+                        break;
                     default:
                         print_help(argv);
                         abort();
@@ -2452,6 +3108,7 @@ int main_filter(int argc, char** argv){
         cerr << "NO KMER SIZE PROVIDED. USING A DEFAULT KMER SIZE OF " << default_kmer_size << endl;
         kmer_sizes.push_back(default_kmer_size);
     }
+    check_kmer_sizes(scheme, kmer_sizes);
 
     string hpv_type_ref_file = refpath + "/" + "all_pave_ref.fa";
     ref_files.push_back( (char*) hpv_type_ref_file.c_str());
@@ -2522,7 +3179,7 @@ int main_filter(int argc, char** argv){
             int hashnum;
             //#pragma omp task
             {
-                calc_hashes(read_seqs[i], read_lens[i], kmer_sizes, h, hashnum, readhtc);
+                calc_hashes(read_seqs[i], read_lens[i], kmer_sizes, h, hashnum, readhtc, scheme);
                 delete[] h;
             }
         }
@@ -2536,21 +3193,30 @@ int main_filter(int argc, char** argv){
     vector<int> lineage_hash_lens;
     vector<int> sublineage_hash_lens;
 
-    // Hash our type references
+    ResultWriter writer(stdout, in_order);
+
+    // Hash our type references. Reads are compared with their full
+    // hash arrays, sorted here with every thread (see radix_sort.hpp).
+    #pragma omp parallel for
+    for (int i = 0; i < nrefs; ++i){
+        calc_hashes(type_seqs[i], type_lens[i], kmer_sizes[0], type_hashes[i], type_hash_lens[i], scheme);
+    }
+    radix_sort_each(type_hashes, type_hash_lens.data(), nrefs);
+    RefIndex type_index(type_hashes, type_hash_lens.data(), nrefs, true);
+
     #pragma omp parallel
     {
 
         // Convert HPV type references -> MinHash signatures
         #pragma omp for
         for (int i = 0; i < nrefs; ++i){
-            calc_hashes(type_seqs[i], type_lens[i], kmer_sizes[0], type_hashes[i], type_hash_lens[i]);
-            minhashes(type_hashes[i], type_hash_lens[i], sketch_size, type_minhashes[i], type_min_lens[i]);
+            sorted_minhashes(type_hashes[i], type_hash_lens[i], sketch_size, type_minhashes[i], type_min_lens[i]);
         }
 
         // hash hpv16 lineage/sublineage sequences
         #pragma omp for
         for (int i = 0; i < n_subtypes; ++i){
-            calc_hashes(subtype_seqs[i], subtype_lens[i], kmer_sizes[0], subtype_hashes[i], subtype_hash_lens[i]);
+            calc_hashes(subtype_seqs[i], subtype_lens[i], kmer_sizes[0], subtype_hashes[i], subtype_hash_lens[i], scheme);
         }
 
 
@@ -2653,34 +3319,40 @@ int main_filter(int argc, char** argv){
         }
 
             
-                #pragma omp for
+                #pragma omp for schedule(dynamic, 64)
                 for (int i = 0; i < read_keys.size(); ++i){
                         // Calculate the hashes of the read and sort them.
                         hash_t* h;
                         int hashnum;
-                        calc_hashes(read_seqs[i], read_lens[i], kmer_sizes, h, hashnum);
+                        calc_hashes(read_seqs[i], read_lens[i], kmer_sizes, h, hashnum, scheme);
                         if (do_read_depth){
                             mask_by_frequency(h, hashnum, readhtc, min_kmer_occ);
                         }
                         
-                        mkmh::sort(h, hashnum);
+                        radix_sort(h, hashnum);
 
                         // Classify read to type
                         int max_shared = -1;
                         int max_id = 0;
+                        vector<int> shared(nrefs);
+                        type_index.count(h, hashnum, shared.data());
                         for (int j = 0; j < nrefs; ++j){
-                            int shared = 0;
-                            hash_set_intersection_size(h, hashnum, type_hashes[j], type_hash_lens[j], shared);
-                            if (shared > max_shared){
-                                max_shared = shared;
+                            if (shared[j] > max_shared){
+                                max_shared = shared[j];
                                 max_id = j;
                             }
                         }
                         string type_name( type_keys[max_id]);
                         // Exact kmer match read to lineage
-                        stringstream st;
-                        st << read_keys[i] << "\t";
-                        st << type_name << "\t" << max_shared << "/" << hashnum << "\t";
+                        out_buf_t st;
+                        st.append(read_keys[i]);
+                        st.append('\t');
+                        st.append(type_name);
+                        st.append('\t');
+                        st.append_int(max_shared);
+                        st.append('/');
+                        st.append_int(hashnum);
+                        st.append('\t');
                         
                         vector<string> lin_names;
                         vector<double> lin_sims;
@@ -2689,10 +3361,13 @@ int main_filter(int argc, char** argv){
                          lineage_hashes, lineage_hash_lens, lin_names, lin_sims, lin_intersections);
                         
                         for (int x = 0; x < lin_names.size(); ++x){
-                            st << lin_names[x] << ":" << lin_sims[x] << ";";
+                            st.append(lin_names[x]);
+                            st.append(':');
+                            st.append_double(lin_sims[x]);
+                            st.append(';');
                         }
                         
-                        st << "\t";
+                        st.append('\t');
 
                         vector<string> sublin_names;
                         vector<double> sublin_sims;
@@ -2700,25 +3375,30 @@ int main_filter(int argc, char** argv){
                         sort_by_similarity(h, hashnum, sublineage_names, sublineage_names.size(),
                          sublineage_hashes, sublineage_hash_lens, sublin_names, sublin_sims, sublin_intersections);
                         for (int x = 0; x < sublin_names.size(); ++x){
-                            st << sublin_names[x] << ":" << sublin_sims[x] << ";";
+                            st.append(sublin_names[x]);
+                            st.append(':');
+                            st.append_double(sublin_sims[x]);
+                            st.append(';');
                         }
 
-                        st << "\t";
+                        st.append('\t');
                         for (int x = 0; x < lin_names.size(); ++x){
-                            st << lin_intersections[x] << ";";
+                            st.append_int(lin_intersections[x]);
+                            st.append(';');
                         }
-                        st << "\t";
+                        st.append('\t');
                         for (int x = 0; x < sublin_names.size(); ++x){
-                            st << sublin_intersections[x] << ";";
+                            st.append_int(sublin_intersections[x]);
+                            st.append(';');
                         }
-                        st << endl;
-                        cout << st.str();
-                        st.str("");
+                        st.append('\n');
+                        writer.write(i, st);
                         delete [] h;
                     }
                 
             
     }
+    writer.close();
     return 0;
         }
         
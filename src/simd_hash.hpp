@@ -0,0 +1,185 @@
+#ifndef RKMH_SIMD_HASH_HPP
+#define RKMH_SIMD_HASH_HPP
+
+#include <cstdint>
+#include "mkmh.hpp"
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define RKMH_X86_SIMD 1
+#endif
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * Batched mixing of packed kmers (see HASH_ROLLING in hashing.hpp).
+ * Packing is inherently serial, one base at a time, but once a run of
+ * windows is packed, their words are independent and are mixed 4 (AVX2)
+ * or 8 (AVX-512) at a time. The instruction set is picked at runtime from
+ * what the CPU supports, so the same binary runs anywhere; every kernel
+ * gives exactly the scalar mix_kmer's hashes.
+ */
+enum hash_isa_t{
+    HASH_ISA_SCALAR,
+    HASH_ISA_AVX2,
+    HASH_ISA_AVX512
+};
+
+inline const char* hash_isa_name(hash_isa_t isa){
+    switch (isa){
+        case HASH_ISA_AVX512: return "avx512";
+        case HASH_ISA_AVX2: return "avx2";
+        default: return "scalar";
+    }
+}
+
+/** True if this CPU can run isa's kernel. */
+inline bool hash_isa_supported(hash_isa_t isa){
+#ifdef RKMH_X86_SIMD
+    __builtin_cpu_init();
+    if (isa == HASH_ISA_AVX512){
+        return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512dq");
+    }
+    if (isa == HASH_ISA_AVX2){
+        return __builtin_cpu_supports("avx2");
+    }
+#else
+    if (isa != HASH_ISA_SCALAR){
+        return false;
+    }
+#endif
+    return true;
+}
+
+/** The widest kernel this CPU supports, detected once. */
+inline hash_isa_t best_hash_isa(){
+    static const hash_isa_t isa = hash_isa_supported(HASH_ISA_AVX512) ? HASH_ISA_AVX512 :
+        hash_isa_supported(HASH_ISA_AVX2) ? HASH_ISA_AVX2 : HASH_ISA_SCALAR;
+    return isa;
+}
+
+#define RKMH_MIX_GOLDEN 0x9e3779b97f4a7c15ULL
+#define RKMH_MIX_C1 0xbf58476d1ce4e5b9ULL
+#define RKMH_MIX_C2 0x94d049bb133111ebULL
+
+/**
+ * Hash a packed kmer (splitmix64's finalizer, offset by k so equal words of
+ * different lengths differ). It is a bijection for each k, so exactly one
+ * kmer of each size hashes to 0 and is dropped like a kmer containing an N.
+ */
+inline hash_t mix_kmer(uint64_t x, int k){
+    x += RKMH_MIX_GOLDEN * (uint64_t) k;
+    x = (x ^ (x >> 30)) * RKMH_MIX_C1;
+    x = (x ^ (x >> 27)) * RKMH_MIX_C2;
+    return x ^ (x >> 31);
+}
+
+inline void mix_kmer_words_scalar(const uint64_t* fwd, const uint64_t* rev, int n, int k,
+        bool lexicographic, hash_t* out){
+    for (int i = 0; i < n; ++i){
+        if (lexicographic){
+            out[i] = mix_kmer(fwd[i] < rev[i] ? fwd[i] : rev[i], k);
+        }
+        else{
+            hash_t f = mix_kmer(fwd[i], k);
+            hash_t r = mix_kmer(rev[i], k);
+            out[i] = f < r ? f : r;
+        }
+    }
+}
+
+#ifdef RKMH_X86_SIMD
+
+// AVX2 has no 64-bit multiply or unsigned 64-bit min; build them from 32-bit pieces.
+__attribute__((target("avx2")))
+inline __m256i mul64_avx2(__m256i a, __m256i b){
+    __m256i lo = _mm256_mul_epu32(a, b);
+    __m256i t1 = _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b);
+    __m256i t2 = _mm256_mul_epu32(a, _mm256_srli_epi64(b, 32));
+    return _mm256_add_epi64(lo, _mm256_slli_epi64(_mm256_add_epi64(t1, t2), 32));
+}
+
+__attribute__((target("avx2")))
+inline __m256i min_epu64_avx2(__m256i a, __m256i b){
+    const __m256i flip = _mm256_set1_epi64x((long long) 0x8000000000000000ULL);
+    __m256i gt = _mm256_cmpgt_epi64(_mm256_xor_si256(a, flip), _mm256_xor_si256(b, flip));
+    return _mm256_blendv_epi8(a, b, gt);
+}
+
+__attribute__((target("avx2")))
+inline __m256i mix_avx2(__m256i x, __m256i offset){
+    const __m256i c1 = _mm256_set1_epi64x((long long) RKMH_MIX_C1);
+    const __m256i c2 = _mm256_set1_epi64x((long long) RKMH_MIX_C2);
+    x = _mm256_add_epi64(x, offset);
+    x = mul64_avx2(_mm256_xor_si256(x, _mm256_srli_epi64(x, 30)), c1);
+    x = mul64_avx2(_mm256_xor_si256(x, _mm256_srli_epi64(x, 27)), c2);
+    return _mm256_xor_si256(x, _mm256_srli_epi64(x, 31));
+}
+
+__attribute__((target("avx2")))
+inline void mix_kmer_words_avx2(const uint64_t* fwd, const uint64_t* rev, int n, int k,
+        bool lexicographic, hash_t* out){
+    const __m256i offset = _mm256_set1_epi64x((long long) (RKMH_MIX_GOLDEN * (uint64_t) k));
+    int i = 0;
+    for (; i + 4 <= n; i += 4){
+        __m256i f = _mm256_loadu_si256((const __m256i*) (fwd + i));
+        __m256i r = _mm256_loadu_si256((const __m256i*) (rev + i));
+        __m256i h = lexicographic ? mix_avx2(min_epu64_avx2(f, r), offset) :
+            min_epu64_avx2(mix_avx2(f, offset), mix_avx2(r, offset));
+        _mm256_storeu_si256((__m256i*) (out + i), h);
+    }
+    mix_kmer_words_scalar(fwd + i, rev + i, n - i, k, lexicographic, out + i);
+}
+
+__attribute__((target("avx512f,avx512dq")))
+inline __m512i mix_avx512(__m512i x, __m512i offset){
+    const __m512i c1 = _mm512_set1_epi64((long long) RKMH_MIX_C1);
+    const __m512i c2 = _mm512_set1_epi64((long long) RKMH_MIX_C2);
+    x = _mm512_add_epi64(x, offset);
+    x = _mm512_mullo_epi64(_mm512_xor_si512(x, _mm512_srli_epi64(x, 30)), c1);
+    x = _mm512_mullo_epi64(_mm512_xor_si512(x, _mm512_srli_epi64(x, 27)), c2);
+    return _mm512_xor_si512(x, _mm512_srli_epi64(x, 31));
+}
+
+__attribute__((target("avx512f,avx512dq")))
+inline void mix_kmer_words_avx512(const uint64_t* fwd, const uint64_t* rev, int n, int k,
+        bool lexicographic, hash_t* out){
+    const __m512i offset = _mm512_set1_epi64((long long) (RKMH_MIX_GOLDEN * (uint64_t) k));
+    int i = 0;
+    for (; i + 8 <= n; i += 8){
+        __m512i f = _mm512_loadu_si512((const void*) (fwd + i));
+        __m512i r = _mm512_loadu_si512((const void*) (rev + i));
+        __m512i h = lexicographic ? mix_avx512(_mm512_min_epu64(f, r), offset) :
+            _mm512_min_epu64(mix_avx512(f, offset), mix_avx512(r, offset));
+        _mm512_storeu_si512((void*) (out + i), h);
+    }
+    mix_kmer_words_scalar(fwd + i, rev + i, n - i, k, lexicographic, out + i);
+}
+
+#endif
+
+/**
+ * The canonical hashes of n packed kmers of size k from their forward and
+ * reverse-complement words, with the given kernel (by default the best one
+ * this CPU has). An isa the CPU can't run falls back to the best one it can.
+ */
+inline void mix_kmer_words(const uint64_t* fwd, const uint64_t* rev, int n, int k,
+        bool lexicographic, hash_t* out, hash_isa_t isa = best_hash_isa()){
+    // each kernel's instructions are a superset of the one below it
+    if (isa > best_hash_isa()){
+        isa = best_hash_isa();
+    }
+#ifdef RKMH_X86_SIMD
+    if (isa == HASH_ISA_AVX512){
+        mix_kmer_words_avx512(fwd, rev, n, k, lexicographic, out);
+        return;
+    }
+    if (isa == HASH_ISA_AVX2){
+        mix_kmer_words_avx2(fwd, rev, n, k, lexicographic, out);
+        return;
+    }
+#endif
+    mix_kmer_words_scalar(fwd, rev, n, k, lexicographic, out);
+}
+
+#endif
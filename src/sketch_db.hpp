@@ -0,0 +1,347 @@
+#ifndef RKMH_SKETCH_DB_HPP
+#define RKMH_SKETCH_DB_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "mkmh.hpp"
+#include "hashing.hpp"
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * Binary sketch database, version 1 (native byte order, i.e. little-endian
+ * on the machines we run on):
+ *
+ *  sketch_db_header_t
+ *  uint64_t name_starts[num_sketches + 1]   byte offsets into the name blob
+ *  char     names[]                         the name blob, padded to 8 bytes
+ *  uint64_t hash_starts[num_sketches + 1]   offsets (in hashes) into the hash block
+ *  hash_t   hashes[]                        each sketch sorted ascending, back to back
+ *  uint64_t locs[]                          only if flags has RKMH_SKETCH_DB_LOCATED:
+ *                                           one per hash, in the same order
+ *
+ * A location is (position << 1) | strand: the 0-based start of the kmer the
+ * hash came from and 1 if its reverse complement gave the hash (see locate_sketch).
+ * All offsets in the header are from the start of the file, so the whole
+ * thing can be mmapped and used in place.
+ */
+#define RKMH_SKETCH_DB_MAGIC "RKMHSKDB"
+#define RKMH_SKETCH_DB_VERSION 1
+#define RKMH_SKETCH_DB_MAX_KMERS 8
+#define RKMH_SKETCH_DB_CANONICAL 1
+// set for rolling 2-bit hashes (-H rolling), clear for MurmurHash3
+#define RKMH_SKETCH_DB_ROLLING 2
+// set if a locs block follows the hashes
+#define RKMH_SKETCH_DB_LOCATED 4
+
+struct sketch_db_header_t{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t hash_seed;
+    uint32_t sketch_size;
+    uint32_t num_kmers;
+    uint32_t kmers[RKMH_SKETCH_DB_MAX_KMERS];
+    uint32_t reserved;
+    uint64_t num_sketches;
+    uint64_t names_offset;
+    uint64_t index_offset;
+    uint64_t hashes_offset;
+};
+static_assert(sizeof(sketch_db_header_t) == 96, "sketch database header must stay 96 bytes");
+
+/**
+ * Write sketches (each sorted ascending, as minhashes returns them) to filename.
+ * If locs is given, locs[i] holds the location of each hash of mins[i].
+ * Returns false if the file can't be written.
+ */
+inline bool write_sketch_db(const string& filename,
+        vector<string>& keys,
+        vector<hash_t*>& mins,
+        vector<int>& min_lens,
+        vector<int>& kmer,
+        int sketch_size,
+        uint32_t hash_seed = 42,
+        bool canonical = true,
+        hash_fn_t fn = HASH_MURMUR3,
+        const vector<const uint64_t*>* locs = NULL){
+
+    if (kmer.size() > RKMH_SKETCH_DB_MAX_KMERS){
+        cerr << "A sketch database can hold at most " << RKMH_SKETCH_DB_MAX_KMERS << " kmer sizes." << endl;
+        return false;
+    }
+    FILE* fp = filename == "-" ? stdout : fopen(filename.c_str(), "wb");
+    if (fp == NULL){
+        return false;
+    }
+
+    uint64_t n = keys.size();
+    vector<uint64_t> name_starts(n + 1, 0);
+    vector<uint64_t> hash_starts(n + 1, 0);
+    for (uint64_t i = 0; i < n; ++i){
+        name_starts[i + 1] = name_starts[i] + keys[i].size();
+        hash_starts[i + 1] = hash_starts[i] + min_lens[i];
+    }
+    uint64_t names_bytes = name_starts[n];
+    uint64_t names_padded = (names_bytes + 7) & ~((uint64_t) 7);
+
+    sketch_db_header_t h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, RKMH_SKETCH_DB_MAGIC, 8);
+    h.version = RKMH_SKETCH_DB_VERSION;
+    h.flags = (canonical ? RKMH_SKETCH_DB_CANONICAL : 0) |
+        (fn == HASH_ROLLING ? RKMH_SKETCH_DB_ROLLING : 0) |
+        (locs != NULL ? RKMH_SKETCH_DB_LOCATED : 0);
+    h.hash_seed = hash_seed;
+    h.sketch_size = sketch_size;
+    h.num_kmers = kmer.size();
+    for (size_t i = 0; i < kmer.size(); ++i){
+        h.kmers[i] = kmer[i];
+    }
+    h.num_sketches = n;
+    h.names_offset = sizeof(h);
+    h.index_offset = h.names_offset + (n + 1) * sizeof(uint64_t) + names_padded;
+    h.hashes_offset = h.index_offset + (n + 1) * sizeof(uint64_t);
+
+    fwrite(&h, sizeof(h), 1, fp);
+    fwrite(name_starts.data(), sizeof(uint64_t), n + 1, fp);
+    for (auto& k : keys){
+        fwrite(k.data(), 1, k.size(), fp);
+    }
+    static const char pad[8] = {0};
+    fwrite(pad, 1, names_padded - names_bytes, fp);
+    fwrite(hash_starts.data(), sizeof(uint64_t), n + 1, fp);
+    for (uint64_t i = 0; i < n; ++i){
+        fwrite(mins[i], sizeof(hash_t), min_lens[i], fp);
+    }
+    if (locs != NULL){
+        for (uint64_t i = 0; i < n; ++i){
+            fwrite((*locs)[i], sizeof(uint64_t), min_lens[i], fp);
+        }
+    }
+
+    bool ok = !ferror(fp);
+    if (fp != stdout){
+        ok = (fclose(fp) == 0) && ok;
+    }
+    else{
+        fflush(fp);
+    }
+    return ok;
+}
+
+/**
+ * A read-only, memory-mapped sketch database.
+ * Sketches are used in place; the pointers from sketch() stay valid
+ * for the lifetime of the SketchDB.
+ */
+class SketchDB{
+    public:
+        SketchDB(const char* filename){
+            int fd = open(filename, O_RDONLY);
+            struct stat st;
+            if (fd < 0 || fstat(fd, &st) != 0){
+                cerr << "Could not open sketch database " << filename << endl;
+                exit(1);
+            }
+            size = st.st_size;
+            if (size < sizeof(sketch_db_header_t)){
+                cerr << filename << " is too small to be an rkmh sketch database." << endl;
+                exit(1);
+            }
+            void* m = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (m == MAP_FAILED){
+                cerr << "Could not mmap " << filename << endl;
+                exit(1);
+            }
+            data = (const char*) m;
+            header = (const sketch_db_header_t*) data;
+
+            if (memcmp(header->magic, RKMH_SKETCH_DB_MAGIC, 8) != 0){
+                cerr << filename << " is not an rkmh sketch database." << endl;
+                exit(1);
+            }
+            if (header->version != RKMH_SKETCH_DB_VERSION){
+                cerr << filename << " is sketch database version " << header->version <<
+                    "; this rkmh reads version " << RKMH_SKETCH_DB_VERSION << "." << endl;
+                exit(1);
+            }
+            uint64_t n = header->num_sketches;
+            if (header->num_kmers > RKMH_SKETCH_DB_MAX_KMERS ||
+                    header->names_offset + (n + 1) * sizeof(uint64_t) > size ||
+                    header->index_offset + (n + 1) * sizeof(uint64_t) > size ||
+                    header->hashes_offset % sizeof(hash_t) != 0){
+                cerr << filename << " is truncated or corrupt." << endl;
+                exit(1);
+            }
+            name_starts = (const uint64_t*) (data + header->names_offset);
+            names = (const char*) (name_starts + n + 1);
+            hash_starts = (const uint64_t*) (data + header->index_offset);
+            hashes = (const hash_t*) (data + header->hashes_offset);
+            locs = located() ? (const uint64_t*) (hashes + hash_starts[n]) : NULL;
+            uint64_t per_hash = sizeof(hash_t) + (located() ? sizeof(uint64_t) : 0);
+            if (header->hashes_offset + hash_starts[n] * per_hash > size ||
+                    (const char*) names + name_starts[n] > data + header->index_offset){
+                cerr << filename << " is truncated or corrupt." << endl;
+                exit(1);
+            }
+        };
+
+        ~SketchDB(){
+            munmap((void*) data, size);
+        };
+
+        /** True if filename starts with the sketch database magic. */
+        static inline bool is_sketch_db(const char* filename){
+            FILE* fp = fopen(filename, "rb");
+            if (fp == NULL){
+                return false;
+            }
+            char m[8];
+            bool ret = fread(m, 1, 8, fp) == 8 && memcmp(m, RKMH_SKETCH_DB_MAGIC, 8) == 0;
+            fclose(fp);
+            return ret;
+        };
+
+        inline uint64_t size_sketches() const{
+            return header->num_sketches;
+        };
+
+        inline string name(uint64_t i) const{
+            return string(names + name_starts[i], name_starts[i + 1] - name_starts[i]);
+        };
+
+        inline const hash_t* sketch(uint64_t i) const{
+            return hashes + hash_starts[i];
+        };
+
+        /** Where each hash of sketch i came from, or NULL if the database isn't located(). */
+        inline const uint64_t* sketch_locs(uint64_t i) const{
+            return locs == NULL ? NULL : locs + hash_starts[i];
+        };
+
+        inline int sketch_len(uint64_t i) const{
+            return hash_starts[i + 1] - hash_starts[i];
+        };
+
+        inline vector<int> kmer() const{
+            return vector<int>(header->kmers, header->kmers + header->num_kmers);
+        };
+
+        inline int sketch_size() const{
+            return header->sketch_size;
+        };
+
+        inline uint32_t hash_seed() const{
+            return header->hash_seed;
+        };
+
+        inline bool canonical() const{
+            return header->flags & RKMH_SKETCH_DB_CANONICAL;
+        };
+
+        inline hash_fn_t hash_fn() const{
+            return (header->flags & RKMH_SKETCH_DB_ROLLING) ? HASH_ROLLING : HASH_MURMUR3;
+        };
+
+        /** True if the database holds each hash's location (rkmh hash -P). */
+        inline bool located() const{
+            return header->flags & RKMH_SKETCH_DB_LOCATED;
+        };
+
+        /** The blocks themselves (see the layout above), for using them in place. */
+        inline const hash_t* hash_block() const{
+            return hashes;
+        };
+
+        inline const uint64_t* hash_index() const{
+            return hash_starts;
+        };
+
+        inline const char* name_blob() const{
+            return names;
+        };
+
+        inline const uint64_t* name_index() const{
+            return name_starts;
+        };
+
+    private:
+        const char* data;
+        uint64_t size;
+        const sketch_db_header_t* header;
+        const uint64_t* name_starts;
+        const char* names;
+        const uint64_t* hash_starts;
+        const hash_t* hashes;
+        const uint64_t* locs;
+};
+
+/**
+ * Map each sketch database in files and append its sketches to keys/mins/min_lens,
+ * pointing into the mapping (the caller must not delete them). The databases are
+ * appended to dbs, which must outlive the sketches.
+ *
+ * If kmer is empty it is set from the first database. Exits if a database was built
+ * with different kmer sizes, a hash function other than fn, another hash seed,
+ * non-canonical kmers, or a sketch smaller than sketch_size; larger sketches are
+ * truncated to sketch_size, which gives the same bottom-s sketch.
+ * If locs is given, each sketch's locations (NULL if its database has none) are appended to it.
+ */
+inline void load_sketch_dbs(vector<char*>& files,
+        vector<int>& kmer,
+        int sketch_size,
+        vector<string>& keys,
+        vector<hash_t*>& mins,
+        vector<int>& min_lens,
+        vector<SketchDB*>& dbs,
+        hash_fn_t fn = HASH_MURMUR3,
+        vector<const uint64_t*>* locs = NULL){
+
+    for (auto f : files){
+        SketchDB* db = new SketchDB(f);
+        if (kmer.empty()){
+            kmer = db->kmer();
+        }
+        if (db->kmer() != kmer){
+            cerr << f << " was sketched with different kmer sizes than requested." << endl;
+            exit(1);
+        }
+        if (db->hash_fn() != fn){
+            cerr << f << " was sketched with " << hash_fn_name(db->hash_fn()) << " hashes; pass -H " <<
+                hash_fn_name(db->hash_fn()) << " to use it." << endl;
+            exit(1);
+        }
+        if (db->hash_seed() != 42 || !db->canonical()){
+            cerr << f << " was not sketched with canonical kmers (hash seed 42)." << endl;
+            exit(1);
+        }
+        if (db->sketch_size() < sketch_size){
+            cerr << f << " has sketches of size " << db->sketch_size() <<
+                ", smaller than the requested sketch size " << sketch_size << "." << endl;
+            exit(1);
+        }
+        for (uint64_t i = 0; i < db->size_sketches(); ++i){
+            keys.push_back(db->name(i));
+            mins.push_back(const_cast<hash_t*>(db->sketch(i)));
+            min_lens.push_back(std::min(db->sketch_len(i), sketch_size));
+            if (locs != NULL){
+                locs->push_back(db->sketch_locs(i));
+            }
+        }
+        dbs.push_back(db);
+    }
+}
+
+#endif
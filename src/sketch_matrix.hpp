@@ -0,0 +1,145 @@
+#ifndef RKMH_SKETCH_MATRIX_HPP
+#define RKMH_SKETCH_MATRIX_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include "mkmh.hpp"
+#include "sketch_db.hpp"
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * A reference panel's sketches as one matrix: every sketch back to back in
+ * a single slab of hashes, an offsets array saying where each row starts,
+ * and the names in one blob with their own offsets. Comparing a read with
+ * every reference walks the slab front to back, which the hardware
+ * prefetcher follows, rather than chasing a pointer to a separate heap
+ * block per reference.
+ *
+ * Built from separate sketches, the slab is copied to memory aligned to a
+ * cache line, with each row padded (with 0s) to start on one. Built from a
+ * sketch database, it is the database's own mapping, used in place: the
+ * layout holds offsets only, no pointers, so the panel written by
+ * `rkmh hash -b` can be mapped and shared by any number of processes.
+ */
+#define RKMH_SKETCH_MATRIX_ALIGN 64
+
+class SketchMatrix{
+    public:
+        /** Copy sketches (and their names) in; mins and lens hold keys.size() of each. */
+        SketchMatrix(const vector<string>& keys, hash_t* const* mins, const int* lens){
+            uint64_t n = keys.size();
+            const uint64_t per_line = RKMH_SKETCH_MATRIX_ALIGN / sizeof(hash_t);
+            owned_starts.resize(n + 1, 0);
+            owned_name_starts.resize(n + 1, 0);
+            row_lens.resize(n);
+            for (uint64_t i = 0; i < n; ++i){
+                row_lens[i] = lens[i];
+                owned_starts[i + 1] = owned_starts[i] + (lens[i] + per_line - 1) / per_line * per_line;
+                owned_name_starts[i + 1] = owned_name_starts[i] + keys[i].size();
+            }
+
+            void* p = NULL;
+            if (posix_memalign(&p, RKMH_SKETCH_MATRIX_ALIGN, std::max(owned_starts[n], (uint64_t) 1) * sizeof(hash_t)) != 0){
+                cerr << "Could not allocate " << owned_starts[n] << " reference hashes." << endl;
+                exit(1);
+            }
+            slab = (hash_t*) p;
+            memset(slab, 0, owned_starts[n] * sizeof(hash_t));
+            owned_names.resize(owned_name_starts[n]);
+            for (uint64_t i = 0; i < n; ++i){
+                memcpy(slab + owned_starts[i], mins[i], lens[i] * sizeof(hash_t));
+                memcpy(&owned_names[owned_name_starts[i]], keys[i].data(), keys[i].size());
+            }
+
+            hashes = slab;
+            starts = owned_starts.data();
+            names = owned_names.data();
+            name_starts = owned_name_starts.data();
+        };
+
+        /** Use the sketches of db in place, each cut to at most sketch_size hashes. */
+        SketchMatrix(const SketchDB& db, int sketch_size){
+            slab = NULL;
+            hashes = db.hash_block();
+            starts = db.hash_index();
+            names = db.name_blob();
+            name_starts = db.name_index();
+            row_lens.resize(db.size_sketches());
+            for (uint64_t i = 0; i < row_lens.size(); ++i){
+                row_lens[i] = std::min(db.sketch_len(i), sketch_size);
+            }
+        };
+
+        ~SketchMatrix(){
+            free(slab);
+        };
+
+        SketchMatrix(const SketchMatrix&) = delete;
+        SketchMatrix& operator=(const SketchMatrix&) = delete;
+
+        inline int size() const{
+            return row_lens.size();
+        };
+
+        inline const hash_t* row(uint64_t i) const{
+            return hashes + starts[i];
+        };
+
+        inline int row_len(uint64_t i) const{
+            return row_lens[i];
+        };
+
+        /** Every row's length, in row order. */
+        inline const int* lens() const{
+            return row_lens.data();
+        };
+
+        /** Row pointers, for code that takes one array per sketch. */
+        inline vector<const hash_t*> rows() const{
+            vector<const hash_t*> ret(size());
+            for (int i = 0; i < size(); ++i){
+                ret[i] = row(i);
+            }
+            return ret;
+        };
+
+        inline const char* name_data(uint64_t i) const{
+            return names + name_starts[i];
+        };
+
+        inline size_t name_len(uint64_t i) const{
+            return name_starts[i + 1] - name_starts[i];
+        };
+
+        inline string name(uint64_t i) const{
+            return string(name_data(i), name_len(i));
+        };
+
+        /** True if the rows are the slab's own copy rather than a database's mapping. */
+        inline bool owned() const{
+            return slab != NULL;
+        };
+
+        inline uint64_t bytes() const{
+            return starts[size()] * sizeof(hash_t);
+        };
+
+    private:
+        hash_t* slab;
+        const hash_t* hashes;
+        const uint64_t* starts;
+        const char* names;
+        const uint64_t* name_starts;
+        vector<int> row_lens;
+        vector<uint64_t> owned_starts;
+        vector<uint64_t> owned_name_starts;
+        vector<char> owned_names;
+};
+
+#endif
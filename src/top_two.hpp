@@ -0,0 +1,137 @@
+#ifndef RKMH_TOP_TWO_HPP
+#define RKMH_TOP_TWO_HPP
+
+#include <algorithm>
+#include "mkmh.hpp"
+#include "bottom_sketch.hpp"
+#include "intersect.hpp"
+#include "sketch_matrix.hpp"
+
+using namespace std;
+using namespace mkmh;
+
+/**
+ * Finding a read's best reference, and whether another comes within
+ * min_diff of it (the -D test), without scoring every reference in full.
+ * A reference's score can grow by at most the slots (or hashes) not yet
+ * compared; once that bound shows it can neither beat the best so far nor
+ * come within min_diff of it, the rest of it is skipped. Scoring the likely
+ * winner first (e.g. the previous read's) sets a high best early, so most
+ * of a panel of similar references is cut short.
+ *
+ * Ties go to the lower reference index, so the result is the same whatever
+ * order references are scored in.
+ */
+#define RKMH_PRUNE_BLOCK 32
+
+/**
+ * The best score and its reference, and the best score of the others that
+ * were scored in full: with pruning, enough to decide best - second > min_diff,
+ * not necessarily the true runner-up. min_diff below 0 turns the test off.
+ */
+struct top_two_t{
+    int best;
+    int best_id;
+    int second;
+    int min_diff;
+
+    /** Only scores above floor count; best_id is -1 until one is offered. */
+    top_two_t(int floor, int min_diff = -1) : best(floor), best_id(-1), second(floor), min_diff(min_diff){};
+
+    inline void offer(int id, int score){
+        if (score > best || (score == best && id < best_id)){
+            second = best;
+            best = score;
+            best_id = id;
+        }
+        else if (score > second){
+            second = score;
+        }
+    };
+
+    /**
+     * The least score reference id needs to change the best match or the
+     * outcome of the -D test; anything lower can be dropped unscored.
+     */
+    inline int needed(int id) const{
+        int to_win = best_id >= 0 && id < best_id ? best : best + 1;
+        int to_fail = min_diff >= 0 ? best - min_diff : to_win;
+        return std::max(second, std::min(to_win, to_fail));
+    };
+};
+
+/**
+ * one_perm_shared, giving up once the slots left can no longer bring the
+ * count up to floor. The count returned is then below floor. That can't
+ * happen before slot len - floor + shared, so slots are compared in one
+ * run up to there, then at least RKMH_PRUNE_BLOCK at a time.
+ */
+inline int one_perm_shared_above(const hash_t* a, const hash_t* b, int len, int floor){
+    int shared = 0;
+    int i = 0;
+    while (i < len){
+        int next = std::min(len, std::max(i + RKMH_PRUNE_BLOCK, len - floor + shared + 1));
+        shared += one_perm_shared(a + i, b + i, next - i);
+        i = next;
+        if (shared + (len - i) < floor){
+            return shared;
+        }
+    }
+    return shared;
+}
+
+/**
+ * Fill tops (num_reads of them, already constructed) with the top two of
+ * each read against refs references. score(r, j, floor) is read r's score
+ * against reference j, and may stop early with any count below floor.
+ *
+ * Reference first is scored against every read first. The rest are taken
+ * ref_tile at a time, and each tile is scored against every read before
+ * the next: with a tile (and the reads) sized to fit in cache, each
+ * reference is fetched from memory once per batch of reads rather than
+ * once per read.
+ */
+template<typename SCORE>
+inline void tiled_top_two(int num_reads, int refs, int ref_tile, int first, top_two_t* tops, SCORE score){
+    if (first < 0 || first >= refs){
+        first = 0;
+    }
+    for (int r = 0; r < num_reads && refs > 0; ++r){
+        tops[r].offer(first, score(r, first, tops[r].needed(first)));
+    }
+    ref_tile = std::max(ref_tile, 1);
+    for (int t = 0; t < refs; t += ref_tile){
+        int end = std::min(refs, t + ref_tile);
+        for (int r = 0; r < num_reads; ++r){
+            for (int j = t; j < end; ++j){
+                if (j != first){
+                    tops[r].offer(j, score(r, j, tops[r].needed(j)));
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Score a read's sketch against the rows of refs, starting with row first,
+ * and keep the top two. Bottom sketches are skipped outright when too short
+ * to matter; one-permutation sketches are compared a block of slots at a
+ * time until they can't.
+ */
+inline top_two_t top_two_scores(const SketchMatrix& refs, const hash_t* read_mins, int read_len,
+        int sketch_size, sketch_scheme_t sketch_scheme, int first, int floor, int min_diff){
+    top_two_t top(floor, min_diff);
+    tiled_top_two(1, refs.size(), refs.size(), first, &top, [&](int /*r*/, int i, int need) -> int{
+        int len = std::min(refs.row_len(i), read_len);
+        if (sketch_scheme != SKETCH_BOTTOM){
+            return one_perm_shared_above(refs.row(i), read_mins, len, need);
+        }
+        if (std::min(len, sketch_size) < need){
+            return std::min(len, sketch_size);
+        }
+        return std::min(sketch_size, (int) hash_intersection_count(refs.row(i), refs.row_len(i), read_mins, read_len));
+    });
+    return top;
+}
+
+#endif
@@ -0,0 +1,238 @@
+#ifndef RKMH_WRITER_HPP
+#define RKMH_WRITER_HPP
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <omp.h>
+
+using namespace std;
+
+/**
+ * A growable byte buffer for building one record's output,
+ * with integer formatting that skips the stream machinery.
+ */
+struct out_buf_t{
+    vector<char> data;
+
+    inline void append(const char* s, size_t len){
+        data.insert(data.end(), s, s + len);
+    };
+
+    inline void append(const char* s){
+        append(s, strlen(s));
+    };
+
+    inline void append(const string& s){
+        append(s.data(), s.size());
+    };
+
+    inline void append(char c){
+        data.push_back(c);
+    };
+
+    inline void append_uint(uint64_t x){
+        static const char digit_pairs[201] =
+            "00010203040506070809"
+            "10111213141516171819"
+            "20212223242526272829"
+            "30313233343536373839"
+            "40414243444546474849"
+            "50515253545556575859"
+            "60616263646566676869"
+            "70717273747576777879"
+            "80818283848586878889"
+            "90919293949596979899";
+        char tmp[20];
+        char* p = tmp + 20;
+        while (x >= 100){
+            int d = (x % 100) * 2;
+            x /= 100;
+            *--p = digit_pairs[d + 1];
+            *--p = digit_pairs[d];
+        }
+        if (x >= 10){
+            int d = x * 2;
+            *--p = digit_pairs[d + 1];
+            *--p = digit_pairs[d];
+        }
+        else{
+            *--p = '0' + x;
+        }
+        append(p, tmp + 20 - p);
+    };
+
+    inline void append_int(int64_t x){
+        if (x < 0){
+            append('-');
+            append_uint(0 - (uint64_t) x);
+        }
+        else{
+            append_uint(x);
+        }
+    };
+
+    /** Formats like ostream's default (%g, six significant digits). */
+    inline void append_double(double x){
+        char tmp[32];
+        int n = snprintf(tmp, sizeof(tmp), "%g", x);
+        append(tmp, n);
+    };
+
+    inline size_t size() const{
+        return data.size();
+    };
+
+    inline void clear(){
+        data.clear();
+    };
+};
+
+/**
+ * Shared output for per-read results written from many threads.
+ *
+ * Unordered (the default), each OpenMP thread appends to its own
+ * buffer, which is written out in one fwrite once it passes
+ * flush_bytes; the only lock is around those large writes.
+ *
+ * Ordered, records are placed in a reorder ring keyed by their index
+ * in the input and written strictly in index order: whichever thread
+ * completes the next expected record drains every consecutive ready
+ * record into a single buffer. A record more than window entries ahead
+ * of the output waits for the window to advance, so loops feeding an
+ * ordered writer should use dynamic scheduling (pipelined_for_each already
+ * keeps one batch in flight, which must be smaller than window).
+ *
+ * Call close() (or let the destructor) flush the remaining output
+ * once all records are in.
+ */
+class ResultWriter{
+    public:
+        ResultWriter(FILE* out = stdout, bool ordered = false, uint64_t first_index = 0,
+                size_t window = 1 << 16, size_t flush_bytes = 1 << 22){
+            this->out = out;
+            this->ordered = ordered;
+            this->window = window;
+            this->flush_bytes = flush_bytes;
+            this->next = first_index;
+            if (ordered){
+                slots = new std::atomic<out_buf_t*>[window];
+                for (size_t i = 0; i < window; ++i){
+                    slots[i].store(NULL);
+                }
+            }
+            else{
+                thread_bufs.resize(omp_get_max_threads());
+            }
+        };
+
+        ~ResultWriter(){
+            close();
+            delete [] slots;
+        };
+
+        /**
+         * Hand over the output of record index. buf is swapped out
+         * (left empty) so the caller can keep reusing it.
+         */
+        inline void write(uint64_t index, out_buf_t& buf){
+            if (!ordered){
+                int tid = omp_get_thread_num();
+                if (tid >= (int) thread_bufs.size()){
+                    std::lock_guard<std::mutex> lock(out_mtx);
+                    fwrite(buf.data.data(), 1, buf.size(), out);
+                    buf.clear();
+                    return;
+                }
+                out_buf_t& t = thread_bufs[tid].buf;
+                t.append(buf.data.data(), buf.size());
+                buf.clear();
+                if (t.size() >= flush_bytes){
+                    std::lock_guard<std::mutex> lock(out_mtx);
+                    fwrite(t.data.data(), 1, t.size(), out);
+                    t.clear();
+                }
+                return;
+            }
+
+            out_buf_t* r = new out_buf_t();
+            r->data.swap(buf.data);
+            while (index >= next.load() + window){
+                std::this_thread::yield();
+            }
+            slots[index % window].store(r);
+            drain();
+        };
+
+        /** Flush everything written so far. Not safe to call concurrently with write(). */
+        inline void close(){
+            if (ordered){
+                drain();
+                flush_drained();
+            }
+            else{
+                for (auto& t : thread_bufs){
+                    fwrite(t.buf.data.data(), 1, t.buf.size(), out);
+                    t.buf.clear();
+                }
+            }
+            fflush(out);
+        };
+
+    private:
+        FILE* out;
+        bool ordered;
+        size_t window;
+        size_t flush_bytes;
+
+        // unordered: one buffer per thread, padded so neighbours don't share a cache line
+        struct alignas(64) thread_buf_t{
+            out_buf_t buf;
+        };
+        vector<thread_buf_t> thread_bufs;
+        std::mutex out_mtx;
+
+        // ordered: reorder ring and the index of the next record to write
+        std::atomic<out_buf_t*>* slots = NULL;
+        std::atomic<uint64_t> next;
+        std::atomic_flag draining = ATOMIC_FLAG_INIT;
+        out_buf_t drained;
+
+        inline void drain(){
+            while (true){
+                if (draining.test_and_set()){
+                    // someone else is draining and will see our record
+                    return;
+                }
+                uint64_t n = next.load();
+                out_buf_t* r;
+                while ((r = slots[n % window].load()) != NULL){
+                    slots[n % window].store(NULL);
+                    drained.append(r->data.data(), r->size());
+                    delete r;
+                    next.store(++n);
+                }
+                if (drained.size() >= flush_bytes){
+                    flush_drained();
+                }
+                draining.clear();
+                // a record may have landed after our last check but before
+                // we released the flag; if so, go around again
+                if (slots[n % window].load() == NULL){
+                    return;
+                }
+            }
+        };
+
+        inline void flush_drained(){
+            fwrite(drained.data.data(), 1, drained.size(), out);
+            drained.clear();
+        };
+};
+
+#endif
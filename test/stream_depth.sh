@@ -0,0 +1,41 @@
+#!/bin/sh
+# Reads with no kmers (all N, or shorter than k) must fail stream's depth
+# test whatever the sketch scheme, even though a one-permutation sketch
+# always has sketch_size slots.
+#
+#   sh test/stream_depth.sh [path/to/rkmh]
+
+RKMH=${1:-./rkmh}
+REFS=$(dirname "$0")/../data/all_pave_ref.fa
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+
+printf '@allN\nNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNNN\n+\nIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIIII\n' > "$TMP/reads.fq"
+printf '@short\nACGT\n+\nIIII\n' >> "$TMP/reads.fq"
+
+status=0
+check(){
+    name=$1
+    shift
+    if ! "$RKMH" stream -r "$REFS" -f "$TMP/reads.fq" -k 16 -s 1000 -N 1 "$@" > "$TMP/out.tsv" 2> "$TMP/err"; then
+        echo "FAIL $name: rkmh exited with an error"
+        cat "$TMP/err"
+        status=1
+        return
+    fi
+    for read in allN short; do
+        if ! grep "	$read	" "$TMP/out.tsv" | grep -q "FAIL:DEPTH"; then
+            echo "FAIL $name: $read did not fail the depth test"
+            status=1
+        fi
+    done
+}
+
+check bottom
+check oph -e oph
+check bits --bits 2
+
+if [ $status -eq 0 ]; then
+    echo "stream_depth: all passed"
+fi
+exit $status